@@ -4,5 +4,6 @@
 #include <elementtree/element.hpp>
 #include <elementtree/feed.hpp>
 #include <elementtree/fileutil.hpp>
+#include <elementtree/frozen.hpp>
 
 #endif
@@ -6,9 +6,18 @@
  * License: http://opensource.org/licenses/MIT
  */
 
+#include <algorithm>
+#include <exception>
+#include <functional>
 #include <iostream>
+#include <map>
+#include <memory>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
 #include <vector>
 #include <mutex>
 
@@ -30,6 +39,8 @@ struct _xmlNode;
 struct _xmlNs;
 struct _xmlXPathCompExpr;
 struct _xmlXPathContext;
+struct _xmlXPathObject;
+struct _xmlXPathParserContext;
 
 
 /**
@@ -42,11 +53,20 @@ using std::vector;
 
 class AttrMap;
 class Element;
+class ElementPath;
 class ElementTree;
 class QName;
+class QNameView;
 class ChildIterator;
+class ElementRange;
+class TextRange;
 class XPath;
 class XPathContext;
+class XPathResult;
+class XPathSet;
+class XPathValue;
+struct ElementPathOp;
+class FrozenElement;
 
 #ifdef ETREE_0X
 typedef std::pair<string, string> kv_pair;
@@ -133,6 +153,30 @@ ElementTree parse(const string &path);
  */
 ElementTree parse(int fd);
 
+/**
+ * Load a document written by ElementTree::save_binary(). This skips
+ * tokenizing, character validation and entity handling, so markup-heavy
+ * documents load 2-3 times faster than with parse(). The file is mapped
+ * into memory only while the tree is built, and may be replaced afterwards.
+ *
+ * @param path          Path to file.
+ * @returns             ElementTree instance.
+ * @throws parse_error  The file is missing, corrupt or was written by an
+ *                      incompatible version of the library.
+ */
+ElementTree load_binary(const string &path);
+
+/**
+ * Load a document written by ElementTree::save_binary() from a file
+ * descriptor. Regular files are mapped; anything else is read until EOF.
+ *
+ * @param fd            File descriptor number.
+ * @returns             ElementTree instance.
+ * @throws parse_error  The file is corrupt or was written by an
+ *                      incompatible version of the library.
+ */
+ElementTree load_binary(int fd);
+
 
 /**
  * ElementTree HTML namespace; public classes and functions are defined here.
@@ -346,6 +390,9 @@ class QName {
     /// Tag part.
     string tag_;
 
+    /// Hash of ns_ and tag_, computed at construction.
+    size_t hash_;
+
     public:
     /**
      * Create a QName from a namespace-tag pair.
@@ -376,6 +423,20 @@ class QName {
      */
     QName(const char *qname);
 
+    /**
+     * Create a QName from Universal Name notation.
+     *
+     * @param qname     Universal name.
+     */
+    QName(std::string_view qname);
+
+    /**
+     * Create a QName by copying a QNameView.
+     *
+     * @param view      QNameView to copy.
+     */
+    QName(const QNameView &view);
+
     /**
      * Serialize a QName in Universal Name notation.
      *
@@ -393,6 +454,31 @@ class QName {
      */
     const string &ns() const;
 
+    /**
+     * Return the QName's hash, as used by std::hash<QName>.
+     */
+    size_t hash() const;
+
+    /**
+     * Return the hash a QName with the given (raw) strings would have,
+     * without constructing one.
+     *
+     * @param ns
+     *      NULL, or the namespace URI.
+     * @param tag
+     *      The tag.
+     */
+    static size_t hash(const char *ns, const char *tag);
+
+    /**
+     * Return the hash a QName with the given namespace and tag would have,
+     * without constructing one.
+     *
+     * @param ns        Namespace URI, or empty.
+     * @param tag       Tag.
+     */
+    static size_t hash(std::string_view ns, std::string_view tag);
+
     /**
      * Return true if the (raw) strings match the QName's content.
      *
@@ -422,269 +508,1234 @@ class QName {
 
 
 /**
- * Represent a list of namespaces and their associated prefixes that should be
- * defined while executing an XPath expression.
- */
-typedef std::vector<std::pair<std::string, std::string>> ns_list;
-
-
-/**
- * Manages a set of registered XPath namespaces and extension functions. Note
- * that this object is internally synchronized across threads, consider copying
- * it in each thread.
+ * A QName that refers to, rather than owns, its namespace and tag. Since
+ * construction needs no allocation, QNameView may be used to declare name
+ * constants that are initialized at compile time:
+ *
+ * \code
+ *      #define ATOM_NS "http://www.w3.org/2005/Atom"
+ *      static constexpr etree::QNameView kTitle("{" ATOM_NS "}title");
+ *      auto title = feed.ensurechild(kTitle);
+ * \endcode
+ *
+ * The referenced strings must outlive the view. Constructors are explicit so
+ * that braced (namespace, tag) pairs continue to select the QName overloads.
  */
-class XPathContext {
-    _xmlXPathContext *context_;
-    std::mutex mtx_;
-
-    // For mutex().
-    friend XPath;
-
-    public:
-    ~XPathContext();
-    XPathContext(const etree::ns_list &ns_list = {});
-    XPathContext(const XPathContext &other);
-};
+class QNameView {
+    /// Namespace part.
+    std::string_view ns_;
 
+    /// Tag part.
+    std::string_view tag_;
 
-/**
- * Manages a compiled XPath expression.
- */
-class XPath {
-    /** The context to execute within, or NULL for no context. */
-    const XPathContext *context_;
+    /// Throw qname_error; kept out of line so parsing remains constexpr.
+    [[noreturn]] static void invalid_();
 
-    /** The underlying compiled expression. */
-    _xmlXPathCompExpr *expr_;
+    static constexpr std::string_view
+    nsPart_(std::string_view qname)
+    {
+        if(qname.empty() || qname[0] != '{') {
+            return std::string_view();
+        }
+        size_t e = qname.find('}');
+        if(e == std::string_view::npos || e == qname.size() - 1) {
+            invalid_();
+        }
+        return qname.substr(1, e - 1);
+    }
 
-    /** String representation of the expression. */
-    string s_;
+    static constexpr std::string_view
+    tagPart_(std::string_view qname)
+    {
+        if(qname.empty() || qname[0] != '{') {
+            return qname;
+        }
+        return qname.substr(qname.find('}') + 1);
+    }
 
     public:
     /**
-     * Destroy the compiled expression.
+     * Create a QNameView from Universal Name notation.
+     *
+     * @param qname     Universal name.
      */
-    ~XPath();
+    explicit constexpr QNameView(std::string_view qname)
+        : ns_(nsPart_(qname))
+        , tag_(tagPart_(qname))
+    {}
 
     /**
-     * Compile an expression from a character array.
+     * Create a QNameView from Universal Name notation.
      *
-     * @param s         XPath expression.
+     * @param qname     Universal name.
      */
-    XPath(const char *s);
+    explicit constexpr QNameView(const char *qname)
+        : QNameView(std::string_view(qname))
+    {}
 
     /**
-     * Compile an expression from a STL string.
+     * Create a QNameView from Universal Name notation.
      *
-     * @param s         XPath expression.
+     * @param qname     Universal name.
      */
-    XPath(const string &s);
+    explicit QNameView(const string &qname)
+        : QNameView(std::string_view(qname))
+    {}
 
     /**
-     * Compile an expression from a STL string.
+     * Create a QNameView referring to a QName's strings.
      *
-     * @param s
-     *      XPath expression.
-     * @param context
-     *      XPathContext object.
+     * @param qname     QName to refer to.
      */
-    XPath(const string &s, const XPathContext &context);
+    explicit QNameView(const QName &qname);
 
     /**
-     * Copy an expression.
-     *
-     * @param other     XPath expression to copy.
+     * Return the tag part of the name.
      */
-    XPath(const XPath &other);
+    constexpr std::string_view tag() const
+    {
+        return tag_;
+    }
 
     /**
-     * Return a string representation of the compiled expression.
+     * Return the namespace URI part of the name.
      */
-    const string &expr() const;
+    constexpr std::string_view ns() const
+    {
+        return ns_;
+    }
 
     /**
-     * Replace this expression with another.
-     *
-     * @param other     XPath expression to assign.
+     * Serialize the name in Universal Name notation.
      */
-    XPath &operator =(const XPath &other);
+    string tostring() const;
 
     /**
-     * Return the first matching Element, if any, matching the expression.
+     * Return true if the (raw) strings match the view's content.
      *
-     * @param e         Root element to search from.
-     * @returns         Matching Element, if any.
+     * @param ns
+     *      NULL, or the namespace URI.
+     * @param tag
+     *      The tag.
      */
-    Nullable<Element> find(const Element &e) const;
+    bool equals(const char *ns, const char *tag) const;
+};
+
+
+/**
+ * An interned QName. Every Atom with the same namespace and tag refers to
+ * a single QName stored in a process-wide table, so Atoms compare by
+ * pointer. Atoms convert to <code>const QName &</code> without copying, and
+ * suit names used repeatedly, such as tags held in constants.
+ *
+ * Interned names are never freed.
+ */
+class Atom {
+    /// Interned QName.
+    const QName *qname_;
 
+    public:
     /**
-     * Return all Elements matching the expression.
+     * Intern a namespace-tag pair.
      *
-     * @param e         Root element to search from.
-     * @returns         Matching Elements.
+     * @param ns        Namespace.
+     * @param tag       Tag.
      */
-    vector<Element> findall(const Element &e) const;
+    Atom(const string &ns, const string &tag);
 
     /**
-     * Like XPath::findall, except remove each discovered element before
-     * returning it.
+     * Intern a QName.
+     *
+     * @param qname     QName.
      */
-    vector<Element> removeall(Element &expr) const;
+    explicit Atom(const QName &qname);
 
     /**
-     * Return the text part of the first matching element.
+     * Intern a name given in Universal Name notation.
      *
-     * @param e
-     *      Root element to search from.
-     * @param default_
-     *      String to return if text is not found.
-     * @returns
-     *      Text part of the first matching element, or the empty string.
+     * @param qname     Universal name.
      */
-    string findtext(const Element &e, const string &default_="") const;
-};
-
-
-/**
- * Proxy value type yielded by AttrIterator.
- */
-class Attribute
-{
-    _xmlAttr *attr_;
-
-    public:
-    Attribute(_xmlAttr *attr);
+    explicit Atom(const char *qname);
 
     /**
-     * Return the attributes's tag name.
+     * Return the interned QName.
      */
-    string tag() const;
+    const QName &qname() const;
 
     /**
-     * Return the attributes's namespace.
+     * Return the tag part of the name.
      */
-    string ns() const;
+    const string &tag() const;
 
     /**
-     * Return the attributes's QName.
+     * Return the namespace URI part of the name.
      */
-    QName qname() const;
+    const string &ns() const;
 
     /**
-     * Return the attribute's value.
+     * Return the interned QName.
      */
-    string value() const;
-};
-
-
-/**
- * Represents iteration position produced by AttrMap::begin() and
- * AttrMap::end().
- *
- * AttrIterator caches its next pointer, so that it is safe to delete an
- * attribute via Element.attrib().remove() during iteration.
- *
- * AttrIterator holds a reference to its parent Element, so that it is safe to
- * remove the element from its source document during iteration.
- */
-class AttrIterator
-{
-    _xmlNode *node_;
-    _xmlAttr *attr_;
-    _xmlAttr *next_;
-
-    public:
-    ~AttrIterator();
-    AttrIterator();
-    AttrIterator(_xmlNode *elem, _xmlAttr *attr);
-
-    bool operator ==(const AttrIterator &other);
-    bool operator !=(const AttrIterator &other);
+    operator const QName &() const;
 
     /**
-     * Yield an Attribute representing the attribute at this position.
+     * Compare this Atom to another.
+     *
+     * @param other     Other Atom.
+     * @returns         True if equal.
      */
-    const Attribute operator *();
+    bool operator==(const Atom &other) const;
 
-    AttrIterator &operator++();
+    /**
+     * Compare this Atom to another.
+     *
+     * @param other     Other Atom.
+     * @returns         False if equal.
+     */
+    bool operator!=(const Atom &other) const;
 };
 
 
 /**
- * Represents a mapping of an Element's attribute names to their values.
+ * A set of QNames that may be probed using raw namespace and tag strings,
+ * such as those taken from a parsed node, without first constructing a
+ * QName.
  */
-class AttrMap
-{
-    _xmlNode *node_;
+class QNameSet {
+    /// Names keyed by QName::hash().
+    std::unordered_multimap<size_t, QName> names_;
 
     public:
-    ~AttrMap();
-    AttrMap(_xmlNode *elem);
-
-    /**
-     * Produce an AttrIterator pointing to the first attribute.
-     */
-    AttrIterator begin() const;
-
     /**
-     * Produce an AttrIterator pointing past the last attribute.
-     */
-    AttrIterator end() const;
-
-    /**
-     * Return true if the Element has the named attribute.
+     * Create an empty set.
      */
-    bool has(const QName &qname) const;
+    QNameSet();
 
+#ifdef ETREE_0X
     /**
-     * Return an attribute's value, or some default.
+     * C++11: create a set from an initializer list.
      *
-     * @param qname
-     *      Attribute QName.
-     * @param default_
-     *      String to return if attribute is not found.
+     * @param names     Initial names.
      */
-    string get(const QName &qname, const string &default_="") const;
+    QNameSet(std::initializer_list<QName> names);
+#endif
 
     /**
-     * Add or replace attribute's value.
+     * Add a name to the set.
      *
-     * @param qname
-     *      Attribute QName.
-     * @param s
-     *      New attribute value.
+     * @param qname     QName to add.
+     * @returns         True if the name was not already present.
      */
-    void set(const QName &qname, const string &s);
+    bool insert(const QName &qname);
 
-    #ifdef ETREE_0X
     /**
-     * C++0x: set multiple attribute values in a single call.
+     * Return true if the name is present.
      *
-     * @param attribs
-     *      std::initializer_list of (QName, value) pairs.
+     * @param qname     QName to look up.
      */
-    void set(kv_list attribs);
-    #endif
+    bool contains(const QName &qname) const;
 
     /**
-     * Return the QNames of all attributes present on the Element.
+     * Return true if the name formed by (raw) strings is present.
+     *
+     * @param ns
+     *      NULL, or the namespace URI.
+     * @param tag
+     *      The tag.
      */
-    vector<QName> keys() const;
+    bool contains(const char *ns, const char *tag) const;
 
     /**
-     * Remove an attribute if it exists, returning true if deletion occured.
+     * Return true if the name formed by a namespace and tag is present.
+     *
+     * @param ns        Namespace URI, or empty.
+     * @param tag       Tag.
      */
-    bool remove(const QName &qname);
+    bool contains(std::string_view ns, std::string_view tag) const;
 
     /**
-     * Return the number of attributes the element has.
+     * Return the number of names in the set.
      */
     size_t size() const;
 };
 
 
 /**
- * Represents a reference to the root of an XML tree, the document itself. Note
+ * Represent a list of namespaces and their associated prefixes that should be
+ * defined while executing an XPath expression.
+ */
+typedef std::vector<std::pair<std::string, std::string>> ns_list;
+
+
+/**
+ * Represent a list of variable names and their string values that should be
+ * bound while executing an XPath expression.
+ */
+typedef std::vector<std::pair<std::string, std::string>> var_list;
+
+
+/**
+ * Value returned by an XPath extension function registered with
+ * XPathContext::function(): a string, number or boolean. Functions used as
+ * predicates should return a boolean, since a number in a predicate selects
+ * by position.
+ */
+class XPathValue {
+    public:
+    /**
+     * Enumeration of XPath value types.
+     */
+    enum value_type {
+        /// XPath string.
+        STRING,
+        /// XPath number.
+        NUMBER,
+        /// XPath boolean.
+        BOOLEAN
+    };
+
+    private:
+    value_type type_;
+    string str_;
+    double number_;
+
+    public:
+    /**
+     * Construct a string value.
+     */
+    XPathValue(const string &s);
+
+    /**
+     * Construct a string value.
+     */
+    XPathValue(const char *s);
+
+    /**
+     * Construct a numeric value.
+     */
+    XPathValue(double n);
+
+    /**
+     * Construct a numeric value.
+     */
+    XPathValue(int n);
+
+    /**
+     * Construct a boolean value.
+     */
+    XPathValue(bool b);
+
+    /**
+     * Return the value's type.
+     */
+    value_type type() const;
+
+    /**
+     * Return the string value, or the empty string if this is not a string.
+     */
+    const string &str() const;
+
+    /**
+     * Return the numeric value. Booleans are 0 or 1, strings are 0.
+     */
+    double number() const;
+};
+
+
+/**
+ * Signature of an XPath extension function. Each argument is passed as its
+ * XPath string value; in particular, a node-set argument is passed as the
+ * string value of its first node.
+ */
+typedef std::function<XPathValue(const vector<string> &args)> xpath_function;
+
+
+/**
+ * Manages a set of registered XPath namespaces and extension functions. Note
+ * that this object is internally synchronized across threads, consider copying
+ * it in each thread.
+ */
+class XPathContext {
+    _xmlXPathContext *context_;
+    std::mutex mtx_;
+
+    /** Canonical form of the registered namespaces, for XPathCache. */
+    string nsKey_;
+
+    /** Extension functions, keyed by namespace URI and name. */
+    std::map<std::pair<string, string>, xpath_function> funcs_;
+
+    /** Exception raised by an extension function during evaluation. */
+    std::exception_ptr error_;
+
+    static void call_(_xmlXPathParserContext *ctxt, int nargs);
+
+    // For mutex().
+    friend XPath;
+    friend XPathSet;
+
+    public:
+    ~XPathContext();
+    XPathContext(const etree::ns_list &ns_list = {});
+
+    /**
+     * Copy the namespaces and variables registered on another context.
+     */
+    XPathContext(const XPathContext &other);
+
+    /**
+     * Bind a variable to a string value, replacing any existing binding, for
+     * every expression subsequently executed within this context.
+     *
+     * \code
+     *      etree::XPathContext ctx;
+     *      etree::XPath byGuid("channel/item[guid=$guid]", ctx);
+     *      ctx.variable("guid", "1234");
+     *      auto item = byGuid.find(rss);
+     * \endcode
+     *
+     * @param name      Variable name, without the leading "$".
+     * @param value     String value.
+     */
+    void variable(const string &name, const string &value);
+
+    /**
+     * Bind a variable to a numeric value, replacing any existing binding.
+     *
+     * @param name      Variable name, without the leading "$".
+     * @param value     Numeric value.
+     */
+    void variable(const string &name, double value);
+
+    /**
+     * Register a C++ function callable from any expression executed within
+     * this context, replacing any existing function of the same name. A
+     * namespaced function is called using a prefix registered for its
+     * namespace URI. Exceptions thrown by the function abort the evaluation
+     * and propagate to the caller of XPath::find() etc.
+     *
+     * \code
+     *      etree::XPathContext ctx(etree::ns_list{{"x", "urn:x"}});
+     *      ctx.function("{urn:x}lower", [](const std::vector<std::string> &a) {
+     *          std::string s(a.at(0));
+     *          std::transform(s.begin(), s.end(), s.begin(), ::tolower);
+     *          return s;
+     *      });
+     *      etree::XPath titled("item[x:lower(title)='news']", ctx);
+     * \endcode
+     *
+     * @param qname     Function namespace URI and name.
+     * @param func      Function implementation.
+     */
+    void function(const QName &qname, const xpath_function &func);
+};
+
+
+/**
+ * Manages a compiled XPath expression.
+ */
+class XPath {
+    /** The context to execute within, or NULL for no context. */
+    const XPathContext *context_;
+
+    /** The underlying compiled expression, possibly shared via XPathCache. */
+    std::shared_ptr<_xmlXPathCompExpr> expr_;
+
+    /** String representation of the expression. */
+    string s_;
+
+    /** Variables bound by bind(), or NULL. */
+    std::shared_ptr<const var_list> vars_;
+
+    static std::shared_ptr<_xmlXPathCompExpr>
+    compile_(const string &s, const XPathContext *context);
+
+    // For context_.
+    friend XPathSet;
+
+    _xmlXPathObject *eval_(const Element &e) const;
+
+    public:
+    /**
+     * Destroy the compiled expression.
+     */
+    ~XPath();
+
+    /**
+     * Compile an expression from a character array.
+     *
+     * @param s         XPath expression.
+     */
+    XPath(const char *s);
+
+    /**
+     * Compile an expression from a STL string.
+     *
+     * @param s         XPath expression.
+     */
+    XPath(const string &s);
+
+    /**
+     * Compile an expression from a STL string.
+     *
+     * @param s
+     *      XPath expression.
+     * @param context
+     *      XPathContext object.
+     */
+    XPath(const string &s, const XPathContext &context);
+
+    /**
+     * Copy an expression.
+     *
+     * @param other     XPath expression to copy.
+     */
+    XPath(const XPath &other);
+
+    /**
+     * Return a string representation of the compiled expression.
+     */
+    const string &expr() const;
+
+    /**
+     * Return a copy of this expression sharing its compiled form, that binds
+     * the given variables each time it is executed. Bindings are private to
+     * the copy: they temporarily override any variable of the same name
+     * registered on the XPathContext for the duration of an evaluation only,
+     * so a single context may be shared by threads binding different values.
+     *
+     * \code
+     *      static const etree::XPath byGuid("channel/item[guid=$guid]");
+     *      auto item = byGuid.bind({{"guid", "1234"}}).find(rss);
+     * \endcode
+     *
+     * @param vars      Variable name-value pairs.
+     * @returns         Bound expression.
+     */
+    XPath bind(const var_list &vars) const;
+
+    /**
+     * Replace this expression with another.
+     *
+     * @param other     XPath expression to assign.
+     */
+    XPath &operator =(const XPath &other);
+
+    /**
+     * Return the first matching Element, if any, matching the expression.
+     *
+     * @param e         Root element to search from.
+     * @returns         Matching Element, if any.
+     */
+    Nullable<Element> find(const Element &e) const;
+
+    /**
+     * Return all Elements matching the expression.
+     *
+     * @param e         Root element to search from.
+     * @returns         Matching Elements.
+     */
+    vector<Element> findall(const Element &e) const;
+
+    /**
+     * Like XPath::findall, except matching Elements are produced on demand
+     * while iterating the result, rather than copied into a vector up front.
+     *
+     * @param e         Root element to search from.
+     * @returns         Lazy result range.
+     */
+    XPathResult iterfind(const Element &e) const;
+
+    /**
+     * Like XPath::findall, except remove each discovered element before
+     * returning it.
+     */
+    vector<Element> removeall(Element &expr) const;
+
+    /**
+     * Return the text part of the first matching element.
+     *
+     * @param e
+     *      Root element to search from.
+     * @param default_
+     *      String to return if text is not found.
+     * @returns
+     *      Text part of the first matching element, or the empty string.
+     */
+    string findtext(const Element &e, const string &default_="") const;
+};
+
+
+/**
+ * A namespace prefix and URI pair that may appear in a constant expression.
+ */
+typedef std::pair<const char *, const char *> ns_literal;
+
+
+/**
+ * An XPath expression compiled on first use rather than on construction.
+ * LazyXPath has a constexpr constructor, so a namespace-scope constant is
+ * initialized without running any code during static initialization, and
+ * neither its XPathContext nor its compiled form exist until it is first
+ * evaluated. Compilation is thread-safe.
+ *
+ * \code
+ *      static constexpr etree::ns_literal kNs[] = {
+ *          {"atom", "http://www.w3.org/2005/Atom"}
+ *      };
+ *      static const etree::LazyXPath kTitlePath("atom:title", kNs);
+ * \endcode
+ *
+ * The expression and namespace strings must outlive the LazyXPath.
+ */
+class LazyXPath {
+    /// Expression.
+    const char *s_;
+
+    /// Namespace array, or NULL.
+    const ns_literal *ns_;
+
+    /// Number of entries in ns_.
+    size_t nsCount_;
+
+    mutable std::once_flag once_;
+    mutable std::unique_ptr<XPathContext> context_;
+    mutable std::unique_ptr<XPath> expr_;
+
+    public:
+    /**
+     * Prepare an expression that uses no namespace prefixes.
+     *
+     * @param s         XPath expression.
+     */
+    constexpr LazyXPath(const char *s)
+        : s_(s)
+        , ns_(NULL)
+        , nsCount_(0)
+        , once_()
+        , context_()
+        , expr_()
+    {}
+
+    /**
+     * Prepare an expression using the given namespace prefixes.
+     *
+     * @param s         XPath expression.
+     * @param ns        Array of prefix-URI pairs.
+     */
+    template<size_t N>
+    constexpr LazyXPath(const char *s, const ns_literal (&ns)[N])
+        : s_(s)
+        , ns_(ns)
+        , nsCount_(N)
+        , once_()
+        , context_()
+        , expr_()
+    {}
+
+    /**
+     * Return the compiled expression, compiling it if necessary.
+     */
+    const XPath &get() const;
+
+    /**
+     * See XPath::find().
+     */
+    Nullable<Element> find(const Element &e) const;
+
+    /**
+     * See XPath::findall().
+     */
+    vector<Element> findall(const Element &e) const;
+
+    /**
+     * See XPath::findtext().
+     */
+    string findtext(const Element &e, const string &default_="") const;
+};
+
+
+/**
+ * Represents iteration position produced by XPathResult::begin() and
+ * XPathResult::end().
+ */
+class XPathIterator
+{
+    _xmlNode **pos_;
+    _xmlNode **end_;
+
+    public:
+    XPathIterator();
+    XPathIterator(_xmlNode **pos, _xmlNode **end);
+    XPathIterator operator++(int);
+    XPathIterator &operator++();
+    bool operator==(const XPathIterator &) const;
+    bool operator!=(const XPathIterator &) const;
+
+    /**
+     * Yield an Element representing the match at this position.
+     */
+    Element operator*() const;
+};
+
+
+/**
+ * Result of XPath::iterfind(). Owns the underlying libxml2 node set and
+ * produces an Element only for each match actually visited, so callers that
+ * iterate once or stop early avoid building a vector of every match.
+ *
+ * XPathResult holds a reference to the Element the expression was evaluated
+ * against, keeping its document alive. Mutating the document while a result
+ * is live may leave it referring to moved or freed nodes.
+ */
+class XPathResult
+{
+    /// Node the expression was evaluated against.
+    _xmlNode *node_;
+
+    /// Underlying result object, shared between copies.
+    std::shared_ptr<_xmlXPathObject> obj_;
+
+    /// Number of element nodes in obj_.
+    size_t size_;
+
+    public:
+    ~XPathResult();
+    XPathResult(_xmlNode *node, _xmlXPathObject *obj);
+    XPathResult(const XPathResult &other);
+    XPathResult &operator=(const XPathResult &other);
+
+    /**
+     * Produce an XPathIterator pointing at the first match.
+     */
+    XPathIterator begin() const;
+
+    /**
+     * Produce an XPathIterator pointing past the final match.
+     */
+    XPathIterator end() const;
+
+    /**
+     * Return the number of matching elements, without constructing them.
+     */
+    size_t size() const;
+
+    /**
+     * Return true if nothing matched.
+     */
+    bool empty() const;
+};
+
+
+/**
+ * Evaluates several XPath expressions together against a single context node,
+ * producing one result slot per expression, in the order they were added.
+ *
+ * Expressions consisting of a single child step, such as <code>title</code>
+ * or <code>atom:title</code>, are resolved together during one scan of the
+ * context node's children. Any other expression is evaluated individually by
+ * libxml2 as XPath::findall() would.
+ *
+ * \code
+ *      etree::XPathSet set;
+ *      size_t title = set.add(etree::XPath("atom:title", ctx));
+ *      size_t guid = set.add(etree::XPath("atom:id", ctx));
+ *      auto texts = set.findtext(entry);
+ *      // texts[title], texts[guid]
+ * \endcode
+ */
+class XPathSet {
+    /// Added expressions.
+    vector<XPath> exprs_;
+
+    /// For each expression, the namespace URI and tag of its child step, or
+    /// an empty tag if the expression must be evaluated by libxml2.
+    vector<std::pair<string, string>> steps_;
+
+    public:
+    /**
+     * Construct an empty set.
+     */
+    XPathSet();
+
+    #ifdef ETREE_0X
+    /**
+     * C++11: construct a set from an initializer list of expressions.
+     *
+     * @param exprs     Expressions to add, assigned consecutive slots.
+     */
+    XPathSet(std::initializer_list<XPath> exprs);
+    #endif
+
+    /**
+     * Add an expression to the set.
+     *
+     * @param expr      Expression to add.
+     * @returns         Index of the expression's result slot.
+     */
+    size_t add(const XPath &expr);
+
+    /**
+     * Return the number of expressions in the set.
+     */
+    size_t size() const;
+
+    /**
+     * Return the first Element matching each expression, if any.
+     *
+     * @param e         Root element to search from.
+     * @returns         One Nullable per expression.
+     */
+    vector<Nullable<Element>> find(const Element &e) const;
+
+    /**
+     * Return all Elements matching each expression.
+     *
+     * @param e         Root element to search from.
+     * @returns         One vector of matching elements per expression.
+     */
+    vector<vector<Element>> findall(const Element &e) const;
+
+    /**
+     * Return the text part of the first element matching each expression.
+     *
+     * @param e
+     *      Root element to search from.
+     * @param default_
+     *      String to use for any expression that does not match.
+     * @returns
+     *      One string per expression.
+     */
+    vector<string> findtext(const Element &e,
+                            const string &default_="") const;
+};
+
+
+/**
+ * Process-wide, bounded LRU cache of compiled XPath expressions, keyed by the
+ * expression text and the namespaces registered on its XPathContext, if any.
+ * Every XPath constructed from a string is compiled through this cache, so
+ * repeatedly constructing identical expressions only compiles them once. The
+ * cache is internally synchronized.
+ */
+class XPathCache {
+    public:
+    /**
+     * Return the maximum number of expressions retained.
+     */
+    static size_t capacity();
+
+    /**
+     * Set the maximum number of expressions retained, evicting the least
+     * recently used entries if the cache is shrinking. Zero disables caching.
+     *
+     * @param n         New capacity.
+     */
+    static void capacity(size_t n);
+
+    /**
+     * Return the number of expressions currently retained.
+     */
+    static size_t size();
+
+    /**
+     * Return the number of XPath constructions satisfied from the cache.
+     */
+    static size_t hits();
+
+    /**
+     * Return the number of XPath constructions that required compilation.
+     */
+    static size_t misses();
+
+    /**
+     * Discard all cached expressions and reset the hit and miss counters.
+     * Existing XPath instances are unaffected.
+     */
+    static void clear();
+};
+
+
+/**
+ * Internal: one instruction of a compiled ElementPath. Step operations move
+ * from a node to zero or more nodes, predicate operations filter the node
+ * produced by the preceding step.
+ */
+struct ElementPathOp {
+    enum op_type {
+        SELF,
+        CHILD,
+        DESCENDANT,
+        PARENT,
+        HAS_ATTR,
+        ATTR_EQUALS,
+        HAS_CHILD,
+        CHILD_TEXT_EQUALS,
+        TEXT_EQUALS,
+        POSITION,
+        LAST
+    };
+
+    op_type type;
+    /// Name test for CHILD and DESCENDANT, attribute or child name for
+    /// predicates.
+    string ns;
+    string tag;
+    bool anyNs;
+    bool anyTag;
+    /// Comparison value for *_EQUALS.
+    string value;
+    /// 1-based position for POSITION, offset from the end for LAST.
+    long index;
+
+    ElementPathOp(op_type type)
+        : type(type), anyNs(false), anyTag(false), index(0) {}
+};
+
+
+/**
+ * A compiled <a
+ * href="https://docs.python.org/3/library/xml.etree.elementtree.html#elementtree-xpath">ElementPath</a>
+ * expression, the limited XPath subset understood by Python ElementTree's
+ * find(), findall() and findtext(). Names are written in Universal Name
+ * notation, or with prefixes from an optional namespace list. Expressions are
+ * evaluated directly over the tree without involving libxml2's XPath engine.
+ *
+ * Supported syntax:
+ *
+ *  - <code>tag</code>, <code>{ns}tag</code>, <code>*</code>,
+ *    <code>{*}tag</code>, <code>{}tag</code>, <code>{ns}*</code>
+ *  - <code>.</code>, <code>..</code>, <code>//</code>
+ *  - <code>[\@attr]</code>, <code>[\@attr='value']</code>
+ *  - <code>[tag]</code>, <code>[tag='text']</code>, <code>[.='text']</code>
+ *  - <code>[1]</code>, <code>[last()]</code>, <code>[last()-1]</code>
+ *
+ * As in Python, results are produced in the order each step visits them, and
+ * descendant steps starting from nested elements may match an element more
+ * than once.
+ */
+class ElementPath {
+    friend class FrozenElement;
+
+    /// Compiled step program, shared between copies.
+    std::shared_ptr<const vector<ElementPathOp>> ops_;
+
+    /// String representation of the expression.
+    string s_;
+
+    public:
+    /**
+     * Compile an expression, throwing invalid_path_error if it is invalid.
+     *
+     * @param s         ElementPath expression.
+     */
+    ElementPath(const char *s);
+
+    /**
+     * Compile an expression, throwing invalid_path_error if it is invalid.
+     *
+     * @param s         ElementPath expression.
+     */
+    ElementPath(const string &s);
+
+    /**
+     * Compile an expression, throwing invalid_path_error if it is invalid.
+     *
+     * @param s
+     *      ElementPath expression.
+     * @param namespaces
+     *      Prefix to namespace URI mapping used to resolve prefixed names.
+     *      The empty prefix sets the default namespace for unprefixed names.
+     */
+    ElementPath(const string &s, const ns_list &namespaces);
+
+    /**
+     * Return a string representation of the compiled expression.
+     */
+    const string &expr() const;
+
+    /**
+     * Return the first matching Element, if any, matching the expression.
+     *
+     * @param e         Root element to search from.
+     * @returns         Matching Element, if any.
+     */
+    Nullable<Element> find(const Element &e) const;
+
+    /**
+     * Return all Elements matching the expression.
+     *
+     * @param e         Root element to search from.
+     * @returns         Matching Elements.
+     */
+    vector<Element> findall(const Element &e) const;
+
+    /**
+     * Return the text part of the first matching element.
+     *
+     * @param e
+     *      Root element to search from.
+     * @param default_
+     *      String to return if no element matches.
+     * @returns
+     *      Text part of the first matching element, or the default.
+     */
+    string findtext(const Element &e, const string &default_="") const;
+};
+
+
+/**
+ * Proxy value type yielded by AttrIterator.
+ */
+class Attribute
+{
+    _xmlAttr *attr_;
+
+    public:
+    Attribute(_xmlAttr *attr);
+
+    /**
+     * Return the attributes's tag name.
+     */
+    string tag() const;
+
+    /**
+     * Return the attributes's namespace.
+     */
+    string ns() const;
+
+    /**
+     * Return the attributes's QName.
+     */
+    QName qname() const;
+
+    /**
+     * Return the attribute's value.
+     */
+    string value() const;
+
+    /**
+     * Return the attribute's value without copying it. When the value is
+     * held in a single text node, as it almost always is, the view refers
+     * directly into the document and is valid until the attribute is
+     * modified or removed. Otherwise the value is assembled into buf, and
+     * the view is valid until buf is modified.
+     *
+     * @param buf       Storage used only for multi-node values.
+     */
+    std::string_view value_view(string &buf) const;
+};
+
+
+/**
+ * One attribute as returned by AttrMap::items(). Fields refer directly into
+ * the document, except for multi-node values; see AttrMap::items().
+ */
+struct AttrItem
+{
+    /// Namespace URI, or empty.
+    std::string_view ns;
+
+    /// Attribute name.
+    std::string_view tag;
+
+    /// Attribute value.
+    std::string_view value;
+};
+
+
+/**
+ * Represents iteration position produced by AttrMap::begin() and
+ * AttrMap::end().
+ *
+ * AttrIterator caches its next pointer, so that it is safe to delete an
+ * attribute via Element.attrib().remove() during iteration.
+ *
+ * AttrIterator holds a reference to its parent Element, so that it is safe to
+ * remove the element from its source document during iteration.
+ */
+class AttrIterator
+{
+    _xmlNode *node_;
+    _xmlAttr *attr_;
+    _xmlAttr *next_;
+
+    public:
+    ~AttrIterator();
+    AttrIterator();
+    AttrIterator(_xmlNode *elem, _xmlAttr *attr);
+
+    bool operator ==(const AttrIterator &other);
+    bool operator !=(const AttrIterator &other);
+
+    /**
+     * Yield an Attribute representing the attribute at this position.
+     */
+    const Attribute operator *();
+
+    AttrIterator &operator++();
+};
+
+
+/**
+ * Represents a mapping of an Element's attribute names to their values.
+ */
+class AttrMap
+{
+    _xmlNode *node_;
+
+    public:
+    ~AttrMap();
+    AttrMap(_xmlNode *elem);
+
+    /**
+     * Produce an AttrIterator pointing to the first attribute.
+     */
+    AttrIterator begin() const;
+
+    /**
+     * Produce an AttrIterator pointing past the last attribute.
+     */
+    AttrIterator end() const;
+
+    /**
+     * Return true if the Element has the named attribute.
+     */
+    bool has(const QName &qname) const;
+
+    /**
+     * Return true if the given attribute exists, without allocating.
+     *
+     * @param qname     Attribute name in Universal Name notation.
+     */
+    bool has(const char *qname) const;
+
+    /**
+     * Return true if the given attribute exists, without allocating.
+     *
+     * @param qname     Attribute name.
+     */
+    bool has(const QNameView &qname) const;
+
+    /**
+     * Return true if the given attribute exists, without allocating.
+     *
+     * @param ns        Attribute namespace URI, or empty.
+     * @param tag       Attribute name.
+     */
+    bool has(std::string_view ns, std::string_view tag) const;
+
+    /**
+     * Return an attribute's value, or some default.
+     *
+     * @param qname
+     *      Attribute QName.
+     * @param default_
+     *      String to return if attribute is not found.
+     */
+    string get(const QName &qname, const string &default_="") const;
+
+    /**
+     * Like get(const QName &, const string &), except the name is parsed
+     * without allocating.
+     *
+     * @param qname
+     *      Attribute name in Universal Name notation.
+     * @param default_
+     *      Default value if attribute is missing.
+     */
+    string get(const char *qname, const string &default_="") const;
+
+    /**
+     * Like get(const QName &, const string &), except the attribute is
+     * located without allocating.
+     *
+     * @param qname
+     *      Attribute name.
+     * @param default_
+     *      Default value if attribute is missing.
+     */
+    string get(const QNameView &qname, const string &default_="") const;
+
+    /**
+     * Return an attribute's value without copying it, or an empty view if
+     * the attribute is missing. See Attribute::value_view() for the
+     * lifetime of the result.
+     *
+     * @param qname     Attribute name in Universal Name notation.
+     * @param buf       Storage used only for multi-node values.
+     */
+    std::string_view get_view(const char *qname, string &buf) const;
+
+    /**
+     * Return an attribute's value without copying it, or an empty view if
+     * the attribute is missing. See Attribute::value_view() for the
+     * lifetime of the result.
+     *
+     * @param qname     Attribute name.
+     * @param buf       Storage used only for multi-node values.
+     */
+    std::string_view get_view(const QNameView &qname, string &buf) const;
+
+    /**
+     * Add or replace attribute's value.
+     *
+     * @param qname
+     *      Attribute QName.
+     * @param s
+     *      New attribute value.
+     */
+    void set(const QName &qname, const string &s);
+
+    #ifdef ETREE_0X
+    /**
+     * C++0x: set multiple attribute values in a single call.
+     *
+     * @param attribs
+     *      std::initializer_list of (QName, value) pairs.
+     */
+    void set(kv_list attribs);
+    #endif
+
+    /**
+     * Return the QNames of all attributes present on the Element.
+     */
+    vector<QName> keys() const;
+
+    /**
+     * Return every attribute's namespace, name and value in a single pass,
+     * without copying them. Views are valid until the attributes are
+     * modified; values held in more than one node are assembled into buf,
+     * and those views are additionally valid only until buf is modified.
+     *
+     * @param buf       Storage used only for multi-node values.
+     * @returns         Attributes in document order.
+     */
+    vector<AttrItem> items(string &buf) const;
+
+    /**
+     * Remove every attribute for which a predicate returns false. The
+     * predicate sees each attribute once, in document order, and may not
+     * modify the attribute list itself.
+     *
+     * @param pred      Predicate returning true to keep an attribute.
+     * @returns         Number of attributes removed.
+     */
+    size_t retain_if(const std::function<bool(const AttrItem &)> &pred);
+
+    /**
+     * Remove an attribute if it exists, returning true if deletion occured.
+     */
+    bool remove(const QName &qname);
+
+    /**
+     * Return the number of attributes the element has.
+     */
+    size_t size() const;
+};
+
+
+/**
+ * Represents a reference to the root of an XML tree, the document itself. Note
  * that an element's documents are created and destroyed dynamically in
  * response to Element::insert(), Element::append() and Element::remove().
  */
@@ -699,8 +1750,105 @@ class ElementTree
     ~ElementTree();
     ElementTree();
     ElementTree(_xmlDoc *doc);
+    ElementTree(const ElementTree &tree);
     Element getroot() const;
 
+    /**
+     * Number every element in the document in document order, allowing XPath
+     * to sort node sets, e.g. the results of union or descendant expressions,
+     * without walking the tree to compare each pair of nodes. Elements
+     * subsequently moved using the Element API lose their number and are
+     * again ordered by walking the tree, so results remain correct; call this
+     * again after heavy mutation to restore full speed.
+     */
+    void prepare_for_queries();
+
+    /**
+     * Return a read-only copy of the document that any number of threads may
+     * read concurrently, e.g. while a writer keeps updating this tree and
+     * periodically publishes a new snapshot:
+     *
+     * \code
+     *      // Writer
+     *      std::atomic_store(&current, tree.snapshot());
+     *
+     *      // Readers
+     *      auto snap = std::atomic_load(&current);
+     *      auto title = snap->getroot().findtext("title");
+     * \endcode
+     *
+     * The copy is numbered as by prepare_for_queries(). Readers may create
+     * and discard Element references freely, but must not modify the
+     * snapshot. Taking a snapshot costs one full copy of the document.
+     */
+    std::shared_ptr<const ElementTree> snapshot() const;
+
+    /**
+     * Write the document in a compact binary form that load_binary() can
+     * reload without parsing, e.g. to warm a cache of parsed documents after
+     * a restart. Elements, attributes, namespace declarations, text, CDATA,
+     * comments and processing instructions are kept; the DTD is not. The
+     * format is versioned and uses the host byte order, so files are not
+     * portable between architectures.
+     *
+     * @param fd            File descriptor to write to.
+     * @throws serialization_error  A write failed.
+     */
+    void save_binary(int fd) const;
+
+    /**
+     * Index every element by name, and optionally by the values of some
+     * attributes, so that find(), findall() and find_by_attr() answer
+     * without walking the tree. Useful when running many queries against
+     * one large document.
+     *
+     * The index belongs to the document, so every ElementTree referring to
+     * it benefits. Renaming, adding, moving or removing elements, or changing
+     * attributes, through Element or AttrMap discards it; lookups then walk
+     * the tree again until build_index() is next called. Changing text keeps
+     * the index.
+     *
+     * @param keys      Attributes whose values should be indexed, e.g. id or
+     *                  guid. Only the first element carrying each value is
+     *                  recorded.
+     */
+    void build_index(const vector<QName> &keys=vector<QName>());
+
+    /**
+     * Return true if the document has an index built by build_index() that
+     * has not since been discarded.
+     */
+    bool indexed() const;
+
+    /**
+     * Return the first element in the document with the given name, which
+     * may be the root. Unlike Element::find(), this takes a name rather than
+     * a path, and uses the index when the document has one.
+     *
+     * @param qn        Element name.
+     */
+    Nullable<Element> find(const QName &qn) const;
+
+    /**
+     * Return every element in the document with the given name, in document
+     * order, including the root if it matches. Uses the index when the
+     * document has one.
+     *
+     * @param qn        Element name.
+     */
+    vector<Element> findall(const QName &qn) const;
+
+    /**
+     * Return the first element in the document whose attribute has the
+     * given value. Uses the index if attr was among the keys passed to
+     * build_index().
+     *
+     * @param attr      Attribute name.
+     * @param value     Attribute value.
+     */
+    Nullable<Element> find_by_attr(const QName &attr,
+                                   const string &value) const;
+
     /**
      * Return true if the identity of this element is equal to another element,
      * i.e. both refer to the same DOM node in the same document.
@@ -736,6 +1884,9 @@ class Element
     /// Never defined.
     Element();
 
+    /// Move each node to the end of this element's children.
+    void extend_(const vector<_xmlNode *> &nodes);
+
     public:
     /**
      * Destroy the reference to the element, deallocating the underlying tree
@@ -837,6 +1988,24 @@ class Element
      */
     string get(const QName &qname, const string &default_="") const;
 
+    /**
+     * Fetch the value of an attribute, parsing its name without allocating.
+     *
+     * @param   qname       Attribute name in Universal Name notation.
+     * @param   default_    Default value if attribute is missing.
+     * @returns             String attribute value, or the default.
+     */
+    string get(const char *qname, const string &default_="") const;
+
+    /**
+     * Fetch the value of an attribute without allocating a QName.
+     *
+     * @param   qname       Attribute name.
+     * @param   default_    Default value if attribute is missing.
+     * @returns             String attribute value, or the default.
+     */
+    string get(const QNameView &qname, const string &default_="") const;
+
     /**
      * Return the number of children this element has.
      */
@@ -864,25 +2033,58 @@ class Element
      * Note the underlying DOM node is not modified, only the reference is
      * updated.
      */
-    Element &operator=(const Element&);
+    Element &operator=(const Element&);
+
+    /**
+     * Return the first, if any exist.
+     *
+     * @returns
+     *      Element, if any, otherwise an empty nullable.
+     */
+    Nullable<Element> child() const;
+
+    /**
+     * Return the first child matching a name, if any exist.
+     *
+     * @param qn
+     *      Name of the child to locate.
+     * @returns
+     *      Element, if any, otherwise an empty nullable.
+     */
+    Nullable<Element> child(const QName &qn) const;
+
+    /**
+     * Return the first child matching a name, if any exist.
+     *
+     * @param qn
+     *      Name of the child to locate.
+     * @returns
+     *      Element, if any, otherwise an empty nullable.
+     */
+    Nullable<Element> child(const QNameView &qn) const;
 
     /**
-     * Return the first, if any exist.
+     * Return the first child matching a name, if any exist. The name is
+     * parsed without allocating, so lookups by literal tag are cheap.
      *
+     * @param qname
+     *      Name in Universal Name notation.
      * @returns
      *      Element, if any, otherwise an empty nullable.
      */
-    Nullable<Element> child() const;
+    Nullable<Element> child(const char *qname) const;
 
     /**
-     * Return the first child matching a name, if any exist.
+     * Return the first child matching a namespace and tag, if any exist.
      *
-     * @param qn
-     *      Name of the child to locate.
+     * @param ns
+     *      Namespace URI, or empty.
+     * @param tag
+     *      Tag.
      * @returns
      *      Element, if any, otherwise an empty nullable.
      */
-    Nullable<Element> child(const QName &qn) const;
+    Nullable<Element> child(std::string_view ns, std::string_view tag) const;
 
     /**
      * Like child(), except appends the element if it was missing.
@@ -894,6 +2096,38 @@ class Element
      */
     Element ensurechild(const QName &qn);
 
+    /**
+     * Like child(), except appends the element if it was missing.
+     *
+     * @param qn
+     *      Name of the child to create or locate.
+     * @returns
+     *      The element.
+     */
+    Element ensurechild(const QNameView &qn);
+
+    /**
+     * Like child(), except appends the element if it was missing.
+     *
+     * @param qname
+     *      Name in Universal Name notation.
+     * @returns
+     *      The element.
+     */
+    Element ensurechild(const char *qname);
+
+    /**
+     * Like child(), except appends the element if it was missing.
+     *
+     * @param ns
+     *      Namespace URI, or empty.
+     * @param tag
+     *      Tag.
+     * @returns
+     *      The element.
+     */
+    Element ensurechild(std::string_view ns, std::string_view tag);
+
     /**
      * Return children matching a name.
      *
@@ -902,6 +2136,31 @@ class Element
      */
     vector<Element> children(const QName &qn) const;
 
+    /**
+     * Return children matching a name.
+     *
+     * @param qn        Name of the children to locate.
+     * @returns         Vector of elements.
+     */
+    vector<Element> children(const QNameView &qn) const;
+
+    /**
+     * Return children matching a name.
+     *
+     * @param qname     Name in Universal Name notation.
+     * @returns         Vector of elements.
+     */
+    vector<Element> children(const char *qname) const;
+
+    /**
+     * Return children matching a namespace and tag.
+     *
+     * @param ns        Namespace URI, or empty.
+     * @param tag       Tag.
+     * @returns         Vector of elements.
+     */
+    vector<Element> children(std::string_view ns, std::string_view tag) const;
+
     /**
      * Return all children.
      *
@@ -917,6 +2176,28 @@ class Element
      */
     Nullable<Element> find(const XPath &expr) const;
 
+    /**
+     * \copybrief ElementPath::find
+     *
+     * @param path      ElementPath expression to match.
+     * @returns         Matching Element, if any.
+     */
+    Nullable<Element> find(const ElementPath &path) const;
+
+    /**
+     * Execute an expression rooted on this element, as an ElementPath if it
+     * is valid ElementPath syntax, otherwise as an XPath.
+     *
+     * @param path      Expression to match.
+     * @returns         Matching Element, if any.
+     */
+    Nullable<Element> find(const string &path) const;
+
+    /**
+     * \copydoc find(const string &) const
+     */
+    Nullable<Element> find(const char *path) const;
+
     /**
      * \copybrief XPath::findtext
      *
@@ -929,6 +2210,31 @@ class Element
      */
     string findtext(const XPath &expr, const string &default_="") const;
 
+    /**
+     * \copybrief ElementPath::findtext
+     *
+     * @param path
+     *      ElementPath expression to match.
+     * @param default_
+     *      String to return if no element matches.
+     * @returns
+     *      Text part of the first matching element, or the default.
+     */
+    string findtext(const ElementPath &path,
+                    const string &default_="") const;
+
+    /**
+     * Like findtext(const ElementPath &, const string &) const, except the
+     * expression is executed as an XPath if it is not valid ElementPath
+     * syntax.
+     */
+    string findtext(const string &path, const string &default_="") const;
+
+    /**
+     * \copydoc findtext(const string &, const string &) const
+     */
+    string findtext(const char *path, const string &default_="") const;
+
     /**
      * \copybrief XPath::findall
      *
@@ -937,6 +2243,33 @@ class Element
      */
     vector<Element> findall(const XPath &expr) const;
 
+    /**
+     * \copybrief ElementPath::findall
+     *
+     * @param path      ElementPath expression to match.
+     * @returns         Matching elements.
+     */
+    vector<Element> findall(const ElementPath &path) const;
+
+    /**
+     * Like findall(const ElementPath &) const, except the expression is
+     * executed as an XPath if it is not valid ElementPath syntax.
+     */
+    vector<Element> findall(const string &path) const;
+
+    /**
+     * \copydoc findall(const string &) const
+     */
+    vector<Element> findall(const char *path) const;
+
+    /**
+     * \copybrief XPath::iterfind
+     *
+     * @param expr      XPath expression to match.
+     * @returns         Lazy result range.
+     */
+    XPathResult iterfind(const XPath &expr) const;
+
     /**
      * Like XPath::findall, except remove each discovered element before
      * returning it.
@@ -975,6 +2308,40 @@ class Element
      */
     void insert(size_t i, Element &e);
 
+    /**
+     * Append several elements to this element, as if by calling append() on
+     * each in turn.
+     *
+     * All elements are checked before any is moved, so if one of them is an
+     * ancestor of this element, nothing changes. Namespace lookups at this
+     * element are shared by every moved element, and document references
+     * are adjusted once per source document, so merging many elements costs
+     * time proportional to the total number of nodes moved.
+     *
+     * @param elems     Elements to append as children, in order.
+     * @throws cyclical_tree_error
+     *      An element is this element or one of its ancestors.
+     */
+    void extend(const vector<Element> &elems);
+
+    /**
+     * Append a range of elements to this element. See
+     * extend(const vector<Element> &).
+     *
+     * @param first     Iterator to the first Element to append.
+     * @param last      Iterator past the last Element to append.
+     */
+    template<typename Iterator>
+    void extend(Iterator first, Iterator last)
+    {
+        vector<_xmlNode *> nodes;
+        for(; first != last; ++first) {
+            const Element &e = *first;
+            nodes.push_back(e.node_);
+        }
+        extend_(nodes);
+    }
+
     /**
      * Remove a child element.
      *
@@ -1025,6 +2392,28 @@ class Element
      */
     Element copy();
 
+    /**
+     * Copy this element and all elements below it directly into another
+     * element's document, appending the copy as its last child. This is
+     * cheaper than copy() followed by append(), as no temporary document is
+     * created and the copy never changes document.
+     *
+     * @param parent    Element to append the copy to.
+     * @returns         The newly copied element.
+     */
+    Element copy_into(Element &parent) const;
+
+    /**
+     * Like copy_into(), except the copy is inserted immediately before
+     * sibling.
+     *
+     * @param sibling   Element to insert the copy before.
+     * @returns         The newly copied element.
+     * @throws out_of_bounds_error
+     *      sibling is the root element of its document.
+     */
+    Element copy_before(Element &sibling) const;
+
     /**
      * Return true if this is an ancestor of some element.
      */
@@ -1063,6 +2452,17 @@ class Element
      */
     string text() const;
 
+    /**
+     * Like text(), except return the text without copying it. When the text
+     * is held in a single node, as is usual for parsed documents, the view
+     * refers directly into that node and is valid until the text is
+     * modified. Otherwise the nodes are concatenated into buf, and the view
+     * is valid until buf is modified.
+     *
+     * @param buf       Storage used only for multi-node text.
+     */
+    std::string_view text_view(string &buf) const;
+
     /**
      * Set the element's text part.
      *
@@ -1084,6 +2484,71 @@ class Element
      */
     string tail() const;
 
+    /**
+     * Like tail(), except return the text without copying it. See
+     * text_view() for the lifetime of the result.
+     *
+     * @param buf       Storage used only for multi-node text.
+     */
+    std::string_view tail_view(string &buf) const;
+
+    /**
+     * Iterate over every text and CDATA chunk in the element's subtree, in
+     * document order, as lxml's itertext() does. The element's own tail is
+     * not included. Chunks refer directly into the document, so nothing is
+     * copied.
+     *
+     * \code
+     *      for(std::string_view chunk : elem.itertext()) {
+     *          index.add(chunk);
+     *      }
+     * \endcode
+     */
+    TextRange itertext() const;
+
+    /**
+     * Iterate over this element and every element below it, in document
+     * order, as Python's Element.iter() does. The walk follows the tree's
+     * own links and an Element is only created for each position actually
+     * dereferenced.
+     *
+     * \code
+     *      for(auto link : elem.iter("{http://www.w3.org/1999/xhtml}a")) {
+     *          urls.push_back(link.get("href"));
+     *      }
+     * \endcode
+     */
+    ElementRange iter() const;
+
+    /**
+     * Like iter(), except only yield elements with the given name.
+     *
+     * @param qn        Name of the elements to yield.
+     */
+    ElementRange iter(const QName &qn) const;
+
+    /**
+     * Like iter(), except only yield elements with the given name.
+     *
+     * @param qn        Name of the elements to yield.
+     */
+    ElementRange iter(const QNameView &qn) const;
+
+    /**
+     * Like iter(), except only yield elements with the given name.
+     *
+     * @param qname     Name in Universal Name notation.
+     */
+    ElementRange iter(const char *qname) const;
+
+    /**
+     * Append every text and CDATA chunk in the element's subtree to out, in
+     * document order, reserving the exact space required first.
+     *
+     * @param out       String to append to.
+     */
+    void textcontent(string &out) const;
+
     /**
      * Set the element's tail part.
      *
@@ -1128,21 +2593,304 @@ class ChildIterator
 
 
 /**
- * Depth-first visit an element and all of its subelements.
+ * Represents iteration position produced by TextRange::begin() and
+ * TextRange::end().
+ */
+class TextIterator
+{
+    _xmlNode *root_;
+    _xmlNode *cur_;
+
+    public:
+    TextIterator();
+    TextIterator(_xmlNode *root, _xmlNode *cur);
+    TextIterator operator++(int);
+    TextIterator &operator++();
+    bool operator==(const TextIterator &) const;
+    bool operator!=(const TextIterator &) const;
+
+    /**
+     * Yield the text chunk at this position.
+     */
+    std::string_view operator*() const;
+};
+
+
+/**
+ * Represents iteration position produced by ElementRange::begin() and
+ * ElementRange::end().
+ */
+class ElementIterator
+{
+    const ElementRange *range_;
+    _xmlNode *cur_;
+    /// Last name and namespace pointers found to match the range's filter.
+    const unsigned char *name_;
+    const void *nsPtr_;
+    bool nsKnown_;
+
+    bool matches_(_xmlNode *node);
+
+    public:
+    ElementIterator();
+    ElementIterator(const ElementRange *range, _xmlNode *cur);
+    ElementIterator operator++(int);
+    ElementIterator &operator++();
+    bool operator==(const ElementIterator &) const;
+    bool operator!=(const ElementIterator &) const;
+
+    /**
+     * Yield an Element representing the element at this position.
+     */
+    Element operator*() const;
+};
+
+
+/**
+ * Result of Element::iter(). Neither the range nor its iterators allocate
+ * while walking.
+ *
+ * ElementRange holds a reference to its Element, keeping its document alive.
+ * Mutating the subtree while iterating may leave iterators referring to
+ * moved or freed nodes.
+ */
+class ElementRange
+{
+    friend class ElementIterator;
+
+    /// Root of the walk.
+    _xmlNode *node_;
+    /// True if only elements named ns_ and tag_ are yielded.
+    bool filter_;
+    string ns_;
+    string tag_;
+
+    public:
+    ~ElementRange();
+    ElementRange(_xmlNode *node);
+    ElementRange(_xmlNode *node, std::string_view ns, std::string_view tag);
+    ElementRange(const ElementRange &other);
+    ElementRange &operator=(const ElementRange &other);
+
+    /**
+     * Produce an ElementIterator pointing at the first match.
+     */
+    ElementIterator begin() const;
+
+    /**
+     * Produce an ElementIterator pointing past the final match.
+     */
+    ElementIterator end() const;
+};
+
+
+/**
+ * Result of Element::itertext(). The walk follows the tree's own sibling and
+ * parent links, so neither the range nor its iterators allocate.
+ *
+ * TextRange holds a reference to its Element, keeping its document alive.
+ * Mutating the subtree while iterating may leave iterators referring to
+ * moved or freed nodes.
+ */
+class TextRange
+{
+    /// Root of the walk.
+    _xmlNode *node_;
+
+    public:
+    ~TextRange();
+    TextRange(_xmlNode *node);
+    TextRange(const TextRange &other);
+    TextRange &operator=(const TextRange &other);
+
+    /**
+     * Produce a TextIterator pointing at the first chunk.
+     */
+    TextIterator begin() const;
+
+    /**
+     * Produce a TextIterator pointing past the final chunk.
+     */
+    TextIterator end() const;
+};
+
+
+/**
+ * Value returned by a visit() callback to steer the walk.
+ */
+enum visit_action {
+    /// Visit the element's children, then carry on in document order.
+    CONTINUE,
+    /// Do not visit the element's children.
+    SKIP_CHILDREN,
+    /// End the walk immediately.
+    STOP
+};
+
+
+/**
+ * \internal
+ * Non-template implementation of visit().
+ */
+bool visit(const Element &elem,
+           visit_action (*func)(void *ctx, Element &e),
+           void *ctx);
+
+
+/**
+ * Depth-first visit an element and all of its subelements, in document
+ * order. The walk follows the tree's own links rather than recursing, so
+ * arbitrarily deep documents are safe, and allocates nothing per element.
+ *
+ * func may modify the element it is passed, including removing or grafting
+ * it, in which case the walk continues with whatever now follows the
+ * element's former position. Other changes to the tree's structure while
+ * the walk is in progress are unsupported.
+ *
+ * \code
+ *      // Collect links outside <script> elements, stopping at 100.
+ *      etree::visit(root, [&](etree::Element &e) {
+ *          if(e.tag() == "script") {
+ *              return etree::SKIP_CHILDREN;
+ *          } else if(e.tag() == "a") {
+ *              links.push_back(e.get("href"));
+ *          }
+ *          return links.size() < 100 ? etree::CONTINUE : etree::STOP;
+ *      });
+ * \endcode
  *
  * @param elem
  *      Element to visit.
  * @param func
- *      Function called as (void)func(Element&);
+ *      Function called as func(Element&), returning either void or a
+ *      visit_action.
+ * @returns
+ *      false if func returned STOP, otherwise true.
  */
 template<typename Function>
-void
+bool
 visit(Element elem, Function func)
 {
-    func(elem);
-    for(auto &child : elem.children()) {
-        visit(child, func);
+    auto call = [](void *ctx, Element &e) -> visit_action {
+        Function &f = *static_cast<Function *>(ctx);
+        if constexpr(std::is_void<decltype(f(e))>::value) {
+            f(e);
+            return CONTINUE;
+        } else {
+            return f(e);
+        }
+    };
+    return visit(elem, +call, static_cast<void *>(&func));
+}
+
+
+/**
+ * \internal
+ * Non-template implementation of parallel_visit(). func additionally receives
+ * the index of the calling worker, below threads, and of the partition being
+ * walked; partitions are numbered in document order.
+ */
+bool parallel_visit(const Element &root,
+                    visit_action (*func)(void *ctx, unsigned worker,
+                                         size_t part, Element &e),
+                    void *ctx,
+                    unsigned threads);
+
+
+/**
+ * Like visit(), but walk the tree using several threads. The tree is split
+ * into partitions by expanding the top levels until there are several per
+ * thread; the few elements above the split are visited first on the calling
+ * thread, then idle threads take the remaining subtrees one at a time, so
+ * uneven subtrees balance out.
+ *
+ * func is called concurrently and in no particular order. It must be safe
+ * to call from several threads, and must only read the tree: creating and
+ * destroying Element references is safe, modifying the tree or evaluating
+ * XPath is not. SKIP_CHILDREN and STOP behave as for visit(), except that
+ * other threads may visit a few more elements before noticing STOP. The
+ * first exception thrown by func stops the walk and is rethrown.
+ *
+ * @param root
+ *      Element to visit.
+ * @param func
+ *      Function called as func(Element&), returning either void or a
+ *      visit_action.
+ * @param threads
+ *      Number of threads to use, including the calling thread, or 0 for one
+ *      per CPU.
+ * @returns
+ *      false if func returned STOP, otherwise true.
+ */
+template<typename Function>
+bool
+parallel_visit(Element root, Function func, unsigned threads=0)
+{
+    auto call = [](void *ctx, unsigned, size_t, Element &e) -> visit_action {
+        Function &f = *static_cast<Function *>(ctx);
+        if constexpr(std::is_void<decltype(f(e))>::value) {
+            f(e);
+            return CONTINUE;
+        } else {
+            return f(e);
+        }
+    };
+    return parallel_visit(root, +call, static_cast<void *>(&func), threads);
+}
+
+
+/**
+ * Return every element below and including root for which pred returns
+ * true, evaluating pred on several threads as parallel_visit() does. The
+ * same restrictions apply to pred. The result is in document order.
+ *
+ * @param root
+ *      Element to search.
+ * @param pred
+ *      Function called as bool pred(const Element&).
+ * @param threads
+ *      Number of threads to use, including the calling thread, or 0 for one
+ *      per CPU.
+ */
+template<typename Predicate>
+vector<Element>
+parallel_findall(Element root, Predicate pred, unsigned threads=0)
+{
+    if(! threads) {
+        threads = std::max(1U, std::thread::hardware_concurrency());
+    }
+
+    typedef std::pair<size_t, Element> Match;
+    struct Context {
+        Predicate &pred;
+        vector<vector<Match>> found;
+    } context {pred, vector<vector<Match>>(threads)};
+
+    auto call = [](void *ctx, unsigned worker, size_t part, Element &e)
+            -> visit_action {
+        Context &c = *static_cast<Context *>(ctx);
+        if(c.pred(static_cast<const Element &>(e))) {
+            c.found[worker].emplace_back(part, e);
+        }
+        return CONTINUE;
+    };
+    parallel_visit(root, +call, static_cast<void *>(&context), threads);
+
+    // Each worker's matches are in document order within each partition it
+    // walked, and partitions are numbered in document order.
+    vector<Match> all;
+    for(auto &found : context.found) {
+        all.insert(all.end(), found.begin(), found.end());
+    }
+    std::stable_sort(all.begin(), all.end(),
+        [](const Match &a, const Match &b) { return a.first < b.first; });
+
+    vector<Element> out;
+    out.reserve(all.size());
+    for(auto &match : all) {
+        out.push_back(match.second);
     }
+    return out;
 }
 
 
@@ -1153,6 +2901,7 @@ visit(Element elem, Function func)
 
 EXCEPTION(cyclical_tree_error)
 EXCEPTION(internal_error)
+EXCEPTION(invalid_path_error)
 EXCEPTION(invalid_xpath_error)
 EXCEPTION(memory_error)
 EXCEPTION(missing_namespace_error)
@@ -1184,6 +2933,12 @@ namespace std {
     {
         size_t operator()(const etree::QName &x) const;
     };
+
+    template<>
+    struct hash<etree::Atom>
+    {
+        size_t operator()(const etree::Atom &x) const;
+    };
 } // namespace
 
 
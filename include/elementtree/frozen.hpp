@@ -0,0 +1,279 @@
+#ifndef ETREE_FROZEN_H
+#define ETREE_FROZEN_H
+
+/*
+ * Copyright David Wilson, 2013.
+ * License: http://opensource.org/licenses/MIT
+ */
+
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "element.hpp"
+
+
+namespace etree {
+
+class FrozenTree;
+
+
+/**
+ * Read-only reference to a single element of a FrozenTree. FrozenElement is
+ * a plain index into its tree, so it is cheap to copy and never allocates,
+ * but it is only valid for as long as the FrozenTree it came from exists and
+ * has not been moved.
+ */
+class FrozenElement
+{
+    const FrozenTree *tree_;
+    uint32_t index_;
+
+    public:
+    FrozenElement(const FrozenTree *tree, uint32_t index);
+
+    /**
+     * Return the element's namespace and tag.
+     */
+    QName qname() const;
+
+    /**
+     * Return the element's tag name.
+     */
+    std::string_view tag() const;
+
+    /**
+     * Return the element's namespace URI, or the empty string.
+     */
+    std::string_view ns() const;
+
+    /**
+     * Return the text appearing before the first child element, as
+     * Element::text() would.
+     */
+    std::string_view text() const;
+
+    /**
+     * Return the text following this element, as Element::tail() would.
+     */
+    std::string_view tail() const;
+
+    /**
+     * Return the value of an attribute, or a default if it is unset.
+     *
+     * @param qn        Attribute name.
+     * @param default_  Value to return if the attribute is unset.
+     */
+    std::string_view get(const QNameView &qn,
+                         std::string_view default_=std::string_view()) const;
+
+    /**
+     * Return the value of an attribute, or a default if it is unset.
+     *
+     * @param qname     Attribute name in Universal Name notation.
+     * @param default_  Value to return if the attribute is unset.
+     */
+    std::string_view get(const char *qname,
+                         std::string_view default_=std::string_view()) const;
+
+    /**
+     * Return every attribute of the element, in document order.
+     */
+    vector<AttrItem> attrib() const;
+
+    /**
+     * Return the number of child elements.
+     */
+    size_t size() const;
+
+    /**
+     * Return a child element by index.
+     *
+     * @param i     Index of the child element.
+     * @throws out_of_bounds_error
+     *      The element has fewer than i+1 children.
+     */
+    FrozenElement operator[](size_t i) const;
+
+    /**
+     * Return the element's child elements.
+     */
+    vector<FrozenElement> children() const;
+
+    /**
+     * Return the first child element with the given name, if any.
+     *
+     * @param qn        Element name.
+     */
+    Nullable<FrozenElement> child(const QNameView &qn) const;
+
+    /**
+     * Return the first child element with the given name, if any.
+     *
+     * @param qname     Element name in Universal Name notation.
+     */
+    Nullable<FrozenElement> child(const char *qname) const;
+
+    /**
+     * Return the element's parent, or an unset Nullable for the root.
+     */
+    Nullable<FrozenElement> getparent() const;
+
+    /**
+     * Return the first element matching an ElementPath expression, if any.
+     * Predicates comparing text, e.g. <code>[.='x']</code>, compare the
+     * concatenated text() and tail() of the element and its descendants.
+     *
+     * @param path      Expression to evaluate.
+     */
+    Nullable<FrozenElement> find(const ElementPath &path) const;
+
+    /**
+     * Return every element matching an ElementPath expression.
+     *
+     * @param path      Expression to evaluate.
+     */
+    vector<FrozenElement> findall(const ElementPath &path) const;
+
+    /**
+     * Return the text of the first element matching an ElementPath
+     * expression, or a default.
+     *
+     * @param path      Expression to evaluate.
+     * @param default_  Value to return if no element matches.
+     */
+    std::string_view findtext(const ElementPath &path,
+                              std::string_view default_=std::string_view()) const;
+
+    /**
+     * Return true if both refer to the same element of the same tree.
+     */
+    bool operator==(const FrozenElement &other) const;
+
+    /**
+     * Return true if the elements differ.
+     */
+    bool operator!=(const FrozenElement &other) const;
+};
+
+
+/**
+ * Immutable copy of an XML document in a compact, flat layout, for large
+ * read-mostly caches of parsed documents. Elements are stored contiguously
+ * in document order with parent and subtree-end indices; element
+ * and attribute names and short strings are interned in a single string
+ * pool, and attributes are packed in one array. A FrozenTree typically needs
+ * several times less memory than the libxml2 tree it replaces, and scans
+ * touch far fewer cache lines.
+ *
+ * As with Element, only elements, attributes, text and tails are kept;
+ * comments, processing instructions and entity references end the text run
+ * they appear in and are otherwise dropped.
+ */
+class FrozenTree
+{
+    friend class FrozenElement;
+    friend class FrozenBuilder_;
+
+    /// ElementPath evaluator, defined in frozen.cpp.
+    struct Path_;
+
+    struct Node_ {
+        /// Index into names_.
+        uint32_t name;
+        /// Parent element, or NONE for the root.
+        uint32_t parent;
+        /// Index past the element's last descendant, which is also its next
+        /// sibling if that is below its parent's end.
+        uint32_t end;
+        /// String ID of text().
+        uint32_t text;
+        /// String ID of tail().
+        uint32_t tail;
+        /// Index of the element's first attribute in attrs_; its attributes
+        /// end where the next element's begin.
+        uint32_t attrs;
+    };
+
+    struct Attr_ {
+        uint32_t name;
+        uint32_t value;
+    };
+
+    struct Name_ {
+        uint32_t ns;
+        uint32_t tag;
+    };
+
+    enum { NONE = UINT32_MAX };
+
+    vector<Node_> nodes_;
+    vector<Attr_> attrs_;
+    vector<Name_> names_;
+    /// Start of each string in pool_, plus the end of the last string.
+    vector<uint32_t> strings_;
+    string pool_;
+
+    FrozenTree();
+    std::string_view str_(uint32_t id) const;
+    uint32_t attrsEnd_(uint32_t index) const;
+    uint32_t findName_(std::string_view ns, std::string_view tag) const;
+
+    public:
+    /**
+     * Copy a document.
+     *
+     * @param tree      Document to copy.
+     */
+    explicit FrozenTree(const ElementTree &tree);
+
+    /**
+     * Copy an element and the elements below it. The copied element becomes
+     * the root, without its tail.
+     *
+     * @param root      Element to copy.
+     */
+    explicit FrozenTree(const Element &root);
+
+    /**
+     * Parse an XML document directly into a FrozenTree, without building a
+     * libxml2 tree first.
+     *
+     * @param s         XML document.
+     * @param n         Length of the document, or 0 to use strlen(s).
+     * @throws xml_error
+     * @throws parse_error
+     */
+    static FrozenTree fromstring(const char *s, size_t n=0);
+
+    /**
+     * Parse an XML document from a stream directly into a FrozenTree.
+     *
+     * @param is        Stream to read from.
+     * @throws xml_error
+     * @throws parse_error
+     */
+    static FrozenTree parse(std::istream &is);
+
+    /**
+     * Return the root element.
+     */
+    FrozenElement getroot() const;
+
+    /**
+     * Return the number of elements in the tree.
+     */
+    size_t size() const;
+
+    /**
+     * Return the number of bytes of heap memory used by the tree.
+     */
+    size_t memory_usage() const;
+};
+
+
+} // namespace
+
+#endif
@@ -0,0 +1,79 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <unistd.h>
+
+#include <elementtree/element.hpp>
+
+
+/**
+ * Parse a fixture and copy its root's children until the document is
+ * `scale` times larger.
+ */
+static etree::ElementTree
+scaled_(const std::string &path, size_t scale)
+{
+    auto tree = etree::parse(path);
+    auto root = tree.getroot();
+    auto children = root.children();
+    for(size_t i = 1; i < scale; i++) {
+        for(auto &child : children) {
+            child.copy_into(root);
+        }
+    }
+    return tree;
+}
+
+
+template<typename Fn>
+static double
+time_(Fn fn, int reps)
+{
+    auto start = std::chrono::steady_clock::now();
+    for(int i = 0; i < reps; i++) {
+        fn();
+    }
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return elapsed.count() / reps;
+}
+
+
+int main(int argc, char **argv)
+{
+    size_t scale = (argc > 1) ? std::atoi(argv[1]) : 200;
+    int reps = (argc > 2) ? std::atoi(argv[2]) : 5;
+    const char *fixtures[] = {
+        "test/testdata/pypy.atom.xml",
+        "test/testdata/metafilter.rss.xml"
+    };
+
+    for(auto fixture : fixtures) {
+        auto tree = scaled_(fixture, scale);
+        std::string xmlPath = "bench_binary.xml";
+        std::string binPath = "bench_binary.bin";
+
+        std::ofstream(xmlPath, std::ios_base::binary) << etree::tostring(tree);
+        FILE *fp = std::fopen(binPath.c_str(), "wb");
+        tree.save_binary(::fileno(fp));
+        std::fclose(fp);
+
+        double parse = time_([&]() { etree::parse(xmlPath); }, reps);
+        double load = time_([&]() { etree::load_binary(binPath); }, reps);
+
+        std::ifstream xmlIs(xmlPath, std::ios_base::binary | std::ios_base::ate);
+        std::ifstream binIs(binPath, std::ios_base::binary | std::ios_base::ate);
+        std::cout << fixture << " x" << scale << "\n"
+                  << "  XML size:       " << xmlIs.tellg() << " bytes\n"
+                  << "  binary size:    " << binIs.tellg() << " bytes\n"
+                  << "  parse():        " << parse << "s\n"
+                  << "  load_binary():  " << load << "s\n"
+                  << "  speedup:        " << (parse / load) << "x\n";
+
+        ::unlink(xmlPath.c_str());
+        ::unlink(binPath.c_str());
+    }
+}
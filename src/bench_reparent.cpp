@@ -0,0 +1,97 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+#include <elementtree/element.hpp>
+
+#define ATOM_NS "http://www.w3.org/2005/Atom"
+
+static std::string
+makeFeed_(size_t count)
+{
+    std::string s = "<feed xmlns=\"" ATOM_NS "\" "
+                    "xmlns:media=\"http://search.yahoo.com/mrss/\">";
+    for(size_t i = 0; i < count; i++) {
+        s += "<entry><title>Entry</title><id>urn:entry:";
+        s += std::to_string(i);
+        s += "</id><link rel=\"alternate\" href=\"http://example.com/\"/>"
+             "<media:thumbnail url=\"http://example.com/t.png\"/>"
+             "<content type=\"html\">Some text</content></entry>";
+    }
+    return s + "</feed>";
+}
+
+
+template<typename Fn>
+static double
+time_(Fn fn)
+{
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start;
+    return elapsed.count();
+}
+
+
+int main(int argc, char **argv)
+{
+    size_t count = (argc > 1) ? std::atoi(argv[1]) : 10000;
+
+    auto xml = makeFeed_(count);
+    auto source = etree::fromstring(xml.c_str(), xml.size());
+    auto dest = etree::fromstring("<feed xmlns=\"" ATOM_NS "\"/>");
+    auto other = etree::fromstring("<feed xmlns=\"" ATOM_NS "\"/>");
+
+    double across = time_([&]() {
+        for(auto &entry : source.children()) {
+            dest.append(entry);
+        }
+    });
+
+    double roundTrip = time_([&]() {
+        for(auto &entry : dest.children()) {
+            other.append(entry);
+        }
+        for(auto &entry : other.children()) {
+            dest.append(entry);
+        }
+    });
+
+    // Moves within one document: from dest into a sibling container.
+    auto archive = etree::SubElement(dest, etree::QName(ATOM_NS, "archive"));
+    double sameDoc = time_([&]() {
+        for(auto &entry : dest.children(etree::QName(ATOM_NS, "entry"))) {
+            archive.append(entry);
+        }
+    });
+
+    auto merged = etree::fromstring("<feed xmlns=\"" ATOM_NS "\"/>");
+    double extended = time_([&]() {
+        merged.extend(archive.children());
+    });
+
+    auto copies = etree::fromstring("<feed xmlns=\"" ATOM_NS "\"/>");
+    auto entries = merged.children();
+    double copyAppend = time_([&]() {
+        for(auto &entry : entries) {
+            auto copy = entry.copy();
+            copies.append(copy);
+        }
+    });
+
+    double copyInto = time_([&]() {
+        for(auto &entry : entries) {
+            entry.copy_into(copies);
+        }
+    });
+
+    std::cout << count << " entries\n"
+              << "across documents:  " << across << "s\n"
+              << "round trip:        " << roundTrip << "s\n"
+              << "within document:   " << sameDoc << "s\n"
+              << "extend():          " << extended << "s\n"
+              << "copy(), append():  " << copyAppend << "s\n"
+              << "copy_into():       " << copyInto << "s\n";
+}
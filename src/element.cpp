@@ -4,14 +4,25 @@
  */
 
 #include <algorithm>
+#include <atomic>
 #include <cassert>
 #include <cctype>
+#include <cerrno>
+#include <cstdint>
 #include <cstdio> // snprintf().
 #include <cstdlib>
 #include <cstring>
+#include <exception>
 #include <fstream>
-#include <map>
+#include <list>
+#include <memory>
 #include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include <libxml/HTMLparser.h>
@@ -23,6 +34,7 @@
 #include <libxml/xpathInternals.h>
 
 #include "elementtree/element.hpp"
+#include "elementtree/frozen.hpp"
 
 
 namespace etree {
@@ -172,9 +184,70 @@ const T *Nullable<T>::operator ->() const
 
 // Instantiations.
 template class Nullable<Element>;
+template class Nullable<FrozenElement>;
 template class Nullable<string>;
 
 
+// ------------------------
+// Document index functions
+// ------------------------
+
+
+/**
+ * Index built by ElementTree::build_index(). It lives in the document's
+ * psvi field, which libxml2 only uses for schema validation results, and is
+ * discarded by any change to element names, attributes or tree structure
+ * made through this library. The raw node pointers it holds therefore stay
+ * valid for as long as the index exists.
+ */
+struct DocIndex_ {
+    /// Elements by Universal Name, in document order.
+    std::unordered_map<string, std::vector<xmlNode *>> byName;
+    /// First element carrying each value of a key attribute, keyed by the
+    /// attribute's Universal Name, a NUL, then the value.
+    std::unordered_map<string, xmlNode *> byAttr;
+    /// Universal Names of the key attributes.
+    std::unordered_set<string> keys;
+};
+
+
+static DocIndex_ *
+indexOf_(const xmlDoc *doc)
+{
+    return static_cast<DocIndex_ *>(doc->psvi);
+}
+
+
+/**
+ * Discard the document's index, if any. Called by everything that renames,
+ * moves, adds or removes elements or changes attributes.
+ */
+static void
+dropIndex_(xmlDoc *doc)
+{
+    if(doc->psvi) {
+        delete indexOf_(doc);
+        doc->psvi = NULL;
+    }
+}
+
+
+/**
+ * Write the Universal Name of a namespace and name into out.
+ */
+static void
+universalName_(string &out, const xmlNs *ns, const xmlChar *name)
+{
+    out.clear();
+    if(ns && ns->href) {
+        out += '{';
+        out += reinterpret_cast<const char *>(ns->href);
+        out += '}';
+    }
+    out += reinterpret_cast<const char *>(name);
+}
+
+
 // ----------------------------------------
 // libxml2 DOM reference counting functions
 // ----------------------------------------
@@ -188,10 +261,31 @@ template class Nullable<string>;
  */
 
 
+/**
+ * Atomically add delta to the count stored in node's _private field,
+ * returning the new count, so threads sharing an ElementTree::snapshot() may
+ * each hold references into it. The field is accessed as a void * rather
+ * than aliased as an intptr_t, which optimizing compilers are free to
+ * reorder.
+ */
+template<typename T>
+static inline intptr_t
+addRef_(T node, intptr_t delta) {
+    void *cur = __atomic_load_n(&node->_private, __ATOMIC_RELAXED);
+    void *next;
+    do {
+        next = reinterpret_cast<void *>(reinterpret_cast<intptr_t>(cur) + delta);
+    } while(! __atomic_compare_exchange_n(&node->_private, &cur, next, true,
+                                          __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+    return reinterpret_cast<intptr_t>(next);
+}
+
+
 template<typename T>
-static inline intptr_t &
+static inline intptr_t
 refCount_(T node) {
-    return *reinterpret_cast<intptr_t *>(&(node->_private));
+    return reinterpret_cast<intptr_t>(
+        __atomic_load_n(&node->_private, __ATOMIC_RELAXED));
 }
 
 
@@ -201,7 +295,7 @@ ref(xmlDoc *doc)
     // Relies on NULL (aka. initial state of _private) being (intptr_t)0, which
     // isn't true on some weird archs.
     assert(doc && (sizeof(void *) >= sizeof(intptr_t)));
-    refCount_(doc)++;
+    addRef_(doc, 1);
     return doc;
 }
 
@@ -209,8 +303,9 @@ ref(xmlDoc *doc)
 static void
 unref(xmlDoc *doc)
 {
-    assert(doc && doc->_private);
-    if(! --refCount_(doc)) {
+    assert(doc && refCount_(doc));
+    if(! addRef_(doc, -1)) {
+        dropIndex_(doc);
         xmlFreeDoc(doc);
     }
 }
@@ -220,7 +315,7 @@ static xmlNode *
 ref(xmlNode *node)
 {
     assert(node);
-    if(! refCount_(node)++) {
+    if(addRef_(node, 1) == 1) {
         ref(node->doc);
     }
     return node;
@@ -230,8 +325,8 @@ ref(xmlNode *node)
 static void
 unref(xmlNode *node)
 {
-    assert(node && node->_private);
-    if(! --refCount_(node)) {
+    assert(node && refCount_(node));
+    if(! addRef_(node, -1)) {
         unref(node->doc);
     }
 }
@@ -241,19 +336,37 @@ unref(xmlNode *node)
 // Internal helper functions
 // -------------------------
 
+/**
+ * Call func for node and every node below it in document order, optionally
+ * including attributes, each visited after its element. Uses the tree's own
+ * links rather than recursion, so hostile nesting depth cannot exhaust the
+ * stack. Entity reference children belong to the entity declaration and are
+ * not visited.
+ */
 template<typename Function>
 static void
 visit(bool visitAttrs, xmlNode *node, Function func)
 {
-    func(node);
-    for(xmlNode *child = node->children; child; child = child->next) {
-        visit(visitAttrs, child, func);
-    }
+    xmlNode *root = node;
+    for(;;) {
+        func(node);
+        if(visitAttrs && node->type == XML_ELEMENT_NODE) {
+            for(auto attr = node->properties; attr; attr = attr->next) {
+                func(reinterpret_cast<xmlNode *>(attr));
+            }
+        }
 
-    if(visitAttrs) {
-        for(auto child = node->properties; child; child = child->next) {
-            func(reinterpret_cast<xmlNode *>(child));
+        if(node->children && node->type != XML_ENTITY_REF_NODE) {
+            node = node->children;
+            continue;
+        }
+        while(node != root && ! node->next) {
+            node = node->parent;
         }
+        if(node == root) {
+            return;
+        }
+        node = node->next;
     }
 }
 
@@ -269,6 +382,27 @@ nextElement_(xmlNode *&p)
     return false;
 }
 
+
+/**
+ * Return the element following cur in a pre-order walk of root's subtree, or
+ * NULL once the walk is complete.
+ */
+static xmlNode *
+nextElementIn_(xmlNode *root, xmlNode *cur)
+{
+    xmlNode *next = cur->children;
+    if(nextElement_(next)) {
+        return next;
+    }
+    for(; cur != root; cur = cur->parent) {
+        next = cur->next;
+        if(nextElement_(next)) {
+            return next;
+        }
+    }
+    return NULL;
+}
+
 static const char *
 toChar_(const xmlChar *s)
 {
@@ -435,78 +569,339 @@ moveTail_(xmlNode *tail, xmlNode *target)
 
 
 /**
- * Removes namespace declarations from an element that are already defined in
- * its parents.  Does not free the xmlNs's, just prepends them to staleNsList.
+ * Flat map holding its first few entries inline and searched linearly.
+ * Namespace reconciliation rarely sees more than a handful of distinct
+ * namespaces, so this avoids the per-entry allocations of std::map.
  */
-static void
-reparentNs_(xmlNode *node,
-            std::map<xmlNs *, xmlNs *> &nsCache,
-            xmlNs *&staleNsList)
-{
-    xmlNs **nsdef = &node->nsDef;
-    while(*nsdef) {
-        xmlNs *nsNext = (*nsdef)->next;
-        xmlNs *ns = ::xmlSearchNsByHref(node->doc, node->parent, (*nsdef)->href);
-        if(! ns) {
-            // new namespace href => keep and cache the ns declaration
-            nsCache.insert(std::make_pair(*nsdef, *nsdef));
+template<typename K, typename V, typename Eq=std::equal_to<K>>
+class SmallMap_
+{
+    enum { INLINE = 8 };
+    std::pair<K, V> inline_[INLINE];
+    std::vector<std::pair<K, V>> spill_;
+    size_t size_;
+
+    public:
+    SmallMap_()
+        : size_(0)
+    {}
+
+    V *find(const K &key)
+    {
+        Eq eq;
+        size_t n = std::min<size_t>(size_, INLINE);
+        for(size_t i = 0; i < n; i++) {
+            if(eq(inline_[i].first, key)) {
+                return &inline_[i].second;
+            }
+        }
+        for(auto &kv : spill_) {
+            if(eq(kv.first, key)) {
+                return &kv.second;
+            }
+        }
+        return NULL;
+    }
+
+    void clear()
+    {
+        size_ = 0;
+        spill_.clear();
+    }
+
+    void insert(const K &key, const V &value)
+    {
+        if(size_ < INLINE) {
+            inline_[size_] = std::make_pair(key, value);
         } else {
-            // known namespace href => cache mapping and strip old ns. prepend
-            // ns to garbage chain.
-            nsCache.insert(std::make_pair(*nsdef, ns));
-            (*nsdef)->next = staleNsList;
-            staleNsList = *nsdef;
+            spill_.emplace_back(key, value);
         }
-        *nsdef = nsNext;
+        size_++;
+    }
+};
+
+
+struct XmlStrEq_
+{
+    bool operator()(const xmlChar *a, const xmlChar *b) const
+    {
+        return ::xmlStrEqual(a, b);
     }
+};
+
+
+/**
+ * Return true if node is an element carrying namespace declarations. Safe to
+ * call on the document node, which has no nsDef field.
+ */
+static bool
+hasNsDef_(xmlNode *node)
+{
+    return node->type == XML_ELEMENT_NODE && node->nsDef;
 }
 
 
 /**
- * Walk all child elements and attributes of a recently relinked node, fixing
- * up their namespace references to point to namespaces existing in the new
- * document, assuming.
+ * Return true if a node moved within its document from oldParent to its
+ * current parent still has every namespace it references in scope, because
+ * neither path below their common ancestor carries declarations.
  */
-static void
-reparent_(xmlNode *startNode)
+static bool
+nsUnchanged_(xmlNode *node, xmlNode *oldParent)
 {
-    std::map<xmlNs *, xmlNs *> nsCache;
-    xmlNs *staleNsList = NULL;
+    if(! oldParent || oldParent->doc != node->doc) {
+        return false;
+    }
 
-    visit(true, startNode, [&](xmlNode *node) {
-        xmlNode *nsParent;
-        switch(node->type) {
-            case XML_ELEMENT_NODE:
-            case XML_COMMENT_NODE:
-            case XML_ENTITY_REF_NODE:
-            case XML_PI_NODE:
-            case XML_XINCLUDE_START:
-            case XML_XINCLUDE_END:
-                reparentNs_(node, nsCache, staleNsList);
-                nsParent = node;
-                break;
-            case XML_ATTRIBUTE_NODE:
-                nsParent = node->parent;
-                break;
-            default:
-                return;
+    auto depth = [](xmlNode *n) {
+        size_t d = 0;
+        for(; n; n = n->parent) {
+            d++;
+        }
+        return d;
+    };
+
+    xmlNode *a = oldParent;
+    xmlNode *b = node->parent;
+    size_t aDepth = depth(a);
+    size_t bDepth = depth(b);
+    for(; aDepth > bDepth; aDepth--, a = a->parent) {
+        if(hasNsDef_(a)) {
+            return false;
+        }
+    }
+    for(; bDepth > aDepth; bDepth--, b = b->parent) {
+        if(hasNsDef_(b)) {
+            return false;
+        }
+    }
+    for(; a != b; a = a->parent, b = b->parent) {
+        if(hasNsDef_(a) || hasNsDef_(b)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/**
+ * Namespace reconciliation state for subtrees relinked below one destination
+ * node. Declarations on moved elements that duplicate one in scope at the
+ * destination are dropped in favour of the destination's, and references to
+ * declarations that did not move are pointed at an equivalent one in scope at
+ * the destination, which is created on the subtree root if necessary.
+ *
+ * Declarations in scope at the destination are indexed by href on first use
+ * and shared by every subtree, so most lookups avoid walking the ancestor
+ * chain. Lookups from nodes below a declaration kept inside a subtree, whose
+ * prefix may shadow the index, fall back to xmlSearchNsByHref().
+ */
+class NsReconciler_
+{
+    xmlNode *dest_;
+    xmlNode *root_;
+    SmallMap_<xmlNs *, xmlNs *> moved_;
+    SmallMap_<const xmlChar *, xmlNs *, XmlStrEq_> inScope_;
+    bool indexed_;
+    xmlNs *stale_;
+
+    void index_()
+    {
+        SmallMap_<const xmlChar *, bool, XmlStrEq_> prefixes;
+        for(xmlNode *cur = dest_; cur; cur = cur->parent) {
+            if(! hasNsDef_(cur)) {
+                continue;
+            }
+            for(xmlNs *ns = cur->nsDef; ns; ns = ns->next) {
+                if(prefixes.find(ns->prefix)) {
+                    continue; // shadowed by a nearer declaration.
+                }
+                prefixes.insert(ns->prefix, true);
+                if(! inScope_.find(ns->href)) {
+                    inScope_.insert(ns->href, ns);
+                }
+            }
+        }
+        indexed_ = true;
+    }
+
+    bool declaredBelowRoot_(xmlNode *node)
+    {
+        for(xmlNode *cur = node; cur != root_ && cur != dest_;
+                cur = cur->parent) {
+            if(cur->nsDef) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool redeclaredAtRoot_(const xmlChar *prefix)
+    {
+        for(xmlNs *ns = root_->nsDef; ns; ns = ns->next) {
+            if(::xmlStrEqual(ns->prefix, prefix)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    xmlNs *find_(xmlNode *from, const xmlChar *href)
+    {
+        if(::xmlStrEqual(href, XML_XML_NAMESPACE)
+                || declaredBelowRoot_(from)) {
+            return ::xmlSearchNsByHref(root_->doc, from, href);
+        }
+
+        bool belowDest = from != dest_;
+        if(belowDest) {
+            for(xmlNs *ns = root_->nsDef; ns; ns = ns->next) {
+                if(::xmlStrEqual(ns->href, href)) {
+                    return ns;
+                }
+            }
+        }
+
+        if(! indexed_) {
+            index_();
+        }
+        xmlNs **ns = inScope_.find(href);
+        if(ns && ! (belowDest && redeclaredAtRoot_((*ns)->prefix))) {
+            return *ns;
         }
+        return NULL;
+    }
 
-        if(node->ns) {
-            auto it = nsCache.find(node->ns);
-            if(it != nsCache.end()) {
-                node->ns = it->second;
+    void stripNsDefs_(xmlNode *node)
+    {
+        xmlNs **nsdef = &node->nsDef;
+        while(*nsdef) {
+            xmlNs *cur = *nsdef;
+            xmlNs *ns = find_(node->parent, cur->href);
+            if(! ns) {
+                // New href: keep the declaration.
+                moved_.insert(cur, cur);
+                nsdef = &cur->next;
             } else {
-                xmlNs *oldNs = node->ns;
-                node->ns = getNs_(nsParent, startNode, toChar_(node->ns->href));
-                nsCache.insert(std::make_pair(oldNs, node->ns));
+                // Known href: map onto the existing declaration, and move
+                // this one to the garbage chain.
+                moved_.insert(cur, ns);
+                *nsdef = cur->next;
+                cur->next = stale_;
+                stale_ = cur;
             }
         }
-    });
+    }
+
+    void remap_(xmlNode *node, xmlNode *scope)
+    {
+        xmlNs **mapped = moved_.find(node->ns);
+        if(mapped) {
+            node->ns = *mapped;
+            return;
+        }
+
+        xmlNs *old = node->ns;
+        xmlNs *ns = find_(scope, old->href);
+        if(! ns) {
+            ns = makeNs_(root_, toChar_(old->href));
+        }
+        moved_.insert(old, ns);
+        node->ns = ns;
+    }
+
+    public:
+    NsReconciler_(xmlNode *dest)
+        : dest_(dest)
+        , root_(NULL)
+        , indexed_(false)
+        , stale_(NULL)
+    {}
+
+    ~NsReconciler_()
+    {
+        if(stale_) {
+            ::xmlFreeNsList(stale_);
+        }
+    }
+
+    /**
+     * Reconcile a subtree just relinked as a child of the destination.
+     */
+    void run(xmlNode *root)
+    {
+        // Mappings made for the previous subtree may name a prefix the new
+        // root redeclares.
+        root_ = root;
+        moved_.clear();
+
+        visit(true, root_, [&](xmlNode *node) {
+            xmlNode *scope;
+            switch(node->type) {
+                case XML_ELEMENT_NODE:
+                    // Forget any position assigned by prepare_for_queries(),
+                    // as it is meaningless at the node's new location.
+                    node->content = NULL;
+                case XML_COMMENT_NODE:
+                case XML_ENTITY_REF_NODE:
+                case XML_PI_NODE:
+                case XML_XINCLUDE_START:
+                case XML_XINCLUDE_END:
+                    stripNsDefs_(node);
+                    scope = node;
+                    break;
+                case XML_ATTRIBUTE_NODE:
+                    scope = node->parent;
+                    break;
+                default:
+                    return;
+            }
+
+            if(node->ns) {
+                remap_(node, scope);
+            }
+        });
+    }
+};
+
 
-    if(staleNsList) {
-        ::xmlFreeNsList(staleNsList);
+/**
+ * Walk all child elements and attributes of a recently relinked node, fixing
+ * up their namespace references to point to namespaces existing in the new
+ * document. The walk is skipped when the node moved within its document
+ * without crossing any namespace declarations.
+ *
+ * @param nsr
+ *      Reconciler for the node's new parent.
+ * @param startNode
+ *      The relinked node.
+ * @param oldParent
+ *      The node's parent before it was relinked, or NULL if unknown.
+ */
+static void
+reparent_(NsReconciler_ &nsr, xmlNode *startNode, xmlNode *oldParent)
+{
+    if(nsUnchanged_(startNode, oldParent)) {
+        if(startNode->content) {
+            // Forget positions assigned by prepare_for_queries().
+            visit(false, startNode, [&](xmlNode *node) {
+                if(node->type == XML_ELEMENT_NODE) {
+                    node->content = NULL;
+                }
+            });
+        }
+        return;
     }
+
+    nsr.run(startNode);
+}
+
+
+static void
+reparent_(xmlNode *startNode, xmlNode *oldParent=NULL)
+{
+    NsReconciler_ nsr(startNode->parent);
+    reparent_(nsr, startNode, oldParent);
 }
 
 
@@ -549,14 +944,46 @@ _setTailText(xmlNode *node, const string &s)
 }
 
 
-static string
-_collectText(xmlNode *node)
+/**
+ * Return a view of the run of text and CDATA nodes starting at node. A
+ * single node is viewed in place; several are concatenated into buf, after
+ * reserving their exact total size.
+ */
+static std::string_view
+_viewText(xmlNode *node, string &buf)
 {
-    string result;
+    xmlNode *first = NULL;
+    size_t count = 0;
+    size_t size = 0;
+    visitText_(node, [&](xmlNode *node) {
+        if(! count++) {
+            first = node;
+        }
+        size += ::strlen((const char *) node->content);
+    });
+
+    if(count == 1) {
+        return std::string_view((const char *) first->content, size);
+    }
+
+    buf.clear();
+    buf.reserve(size);
     visitText_(node, [&](xmlNode *node) {
-        result += (const char *) node->content;
+        buf += (const char *) node->content;
     });
-    return result;
+    return buf;
+}
+
+
+static string
+_collectText(xmlNode *node)
+{
+    string buf;
+    auto view = _viewText(node, buf);
+    if(view.data() == buf.data()) {
+        return buf;
+    }
+    return string(view);
 }
 
 
@@ -565,6 +992,33 @@ _collectText(xmlNode *node)
 // ---------------
 
 
+/**
+ * Hash a namespace-tag pair as a single FNV-1a stream, with the namespace
+ * length folded in between the parts, then finish with the MurmurHash3
+ * 64-bit mixer. Feeding both parts through one stream means swapping the
+ * namespace and tag changes the result, unlike XOR-combining two hashes.
+ */
+static size_t
+hashName_(const char *ns, size_t nsLen, const char *tag, size_t tagLen)
+{
+    uint64_t h = 14695981039346656037ULL;
+    for(size_t i = 0; i < nsLen; i++) {
+        h = (h ^ (unsigned char) ns[i]) * 1099511628211ULL;
+    }
+    h = (h ^ nsLen) * 1099511628211ULL;
+    for(size_t i = 0; i < tagLen; i++) {
+        h = (h ^ (unsigned char) tag[i]) * 1099511628211ULL;
+    }
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return (size_t) h;
+}
+
+
 string
 QName::tostring() const
 {
@@ -585,6 +1039,7 @@ QName::tostring() const
 QName::QName(const string &ns, const string &tag)
     : ns_(ns)
     , tag_(tag)
+    , hash_(hashName_(ns.data(), ns.size(), tag.data(), tag.size()))
 {
 }
 
@@ -592,33 +1047,23 @@ QName::QName(const string &ns, const string &tag)
 QName::QName(const QName &other)
     : ns_(other.ns_)
     , tag_(other.tag_)
+    , hash_(other.hash_)
 {
 }
 
 
 QName::QName(const string &qname)
-{
-    if(qname.size() > 0 && qname[0] == '{') {
-        size_t e = qname.find('}');
-        if(e == string::npos) {
-            throw qname_error();
-        } else if(qname.size() - 1 == e) {
-            throw qname_error();
-        }
-        ns_ = qname.substr(1, e - 1);
-        tag_ = qname.substr(e + 1);
-        if(tag_.size() == 0) {
-            throw qname_error();
-        }
-    } else {
-        ns_ = "";
-        tag_ = qname;
-    }
-}
+    : QName(QNameView(qname))
+{}
 
 
 QName::QName(const char *qname)
-    : QName(std::string(qname))
+    : QName(QNameView(qname))
+{}
+
+
+QName::QName(std::string_view qname)
+    : QName(QNameView(qname))
 {}
 
 
@@ -636,6 +1081,28 @@ QName::ns() const
 }
 
 
+size_t
+QName::hash() const
+{
+    return hash_;
+}
+
+
+size_t
+QName::hash(const char *ns, const char *tag)
+{
+    return hashName_(ns ? ns : "", ns ? ::strlen(ns) : 0,
+                     tag, ::strlen(tag));
+}
+
+
+size_t
+QName::hash(std::string_view ns, std::string_view tag)
+{
+    return hashName_(ns.data(), ns.size(), tag.data(), tag.size());
+}
+
+
 bool
 QName::equals(const char *ns, const char *tag) const
 {
@@ -654,7 +1121,7 @@ QName::equals(const char *ns, const char *tag) const
 bool
 QName::operator==(const QName &other) const
 {
-    return other.tag_ == tag_ && other.ns_ == ns_;
+    return other.hash_ == hash_ && other.tag_ == tag_ && other.ns_ == ns_;
 }
 
 
@@ -665,486 +1132,2608 @@ QName::operator!=(const QName &other) const
 }
 
 
-// ----------------------
-// XPathContext functions
-// ----------------------
+QName::QName(const QNameView &view)
+    : ns_(view.ns())
+    , tag_(view.tag())
+    , hash_(hashName_(ns_.data(), ns_.size(), tag_.data(), tag_.size()))
+{
+}
 
 
-static std::vector<Element>
-xpathNodesetToVector_(xmlNodeSet *set)
+// -------------------
+// QNameView functions
+// -------------------
+
+
+void
+QNameView::invalid_()
 {
-    std::vector<Element> out;
-    for(int i = 0; set && i < set->nodeNr; i++) {
-        xmlNode *node = set->nodeTab[i];
-        if(node->type == XML_ELEMENT_NODE) {
-            out.push_back(set->nodeTab[i]);
-        }
-    }
-    return out;
+    throw qname_error();
 }
 
 
-XPathContext::~XPathContext()
+QNameView::QNameView(const QName &qname)
+    : ns_(qname.ns())
+    , tag_(qname.tag())
 {
-    std::lock_guard<std::mutex> lock(mtx_);
-    ::xmlXPathFreeContext(context_);
-    context_ = NULL;
 }
 
 
-XPathContext::XPathContext(const etree::ns_list &ns_list)
+string
+QNameView::tostring() const
 {
-    ::xmlResetLastError();
+    return QName(*this).tostring();
+}
 
-    context_ = xmlXPathNewContext(NULL);
+
+bool
+QNameView::equals(const char *ns, const char *tag) const
+{
+    if(ns ? ns_ != ns : ! ns_.empty()) {
+        return false;
+    }
+    return tag_ == tag;
+}
+
+
+// -----------------
+// QNameSet functions
+// -----------------
+
+
+QNameSet::QNameSet()
+{
+}
+
+
+#ifdef ETREE_0X
+QNameSet::QNameSet(std::initializer_list<QName> names)
+{
+    for(auto &qname : names) {
+        insert(qname);
+    }
+}
+#endif
+
+
+bool
+QNameSet::insert(const QName &qname)
+{
+    if(contains(qname)) {
+        return false;
+    }
+    names_.emplace(qname.hash(), qname);
+    return true;
+}
+
+
+bool
+QNameSet::contains(const QName &qname) const
+{
+    auto range = names_.equal_range(qname.hash());
+    for(auto it = range.first; it != range.second; ++it) {
+        if(it->second == qname) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+bool
+QNameSet::contains(const char *ns, const char *tag) const
+{
+    auto range = names_.equal_range(QName::hash(ns, tag));
+    for(auto it = range.first; it != range.second; ++it) {
+        if(it->second.equals(ns, tag)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+bool
+QNameSet::contains(std::string_view ns, std::string_view tag) const
+{
+    auto range = names_.equal_range(QName::hash(ns, tag));
+    for(auto it = range.first; it != range.second; ++it) {
+        if(it->second.ns() == ns && it->second.tag() == tag) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+size_t
+QNameSet::size() const
+{
+    return names_.size();
+}
+
+
+// --------------
+// Atom functions
+// --------------
+
+
+/**
+ * Process-wide table of interned names. unordered_set never moves its
+ * elements, so pointers handed out remain valid as the table grows.
+ */
+struct AtomTable_ {
+    std::mutex mutex;
+    std::unordered_set<QName> names;
+};
+
+
+static AtomTable_ &
+atomTable_()
+{
+    static AtomTable_ table;
+    return table;
+}
+
+
+static const QName *
+intern_(const QName &qname)
+{
+    auto &table = atomTable_();
+    std::lock_guard<std::mutex> lock(table.mutex);
+    return &*table.names.insert(qname).first;
+}
+
+
+Atom::Atom(const string &ns, const string &tag)
+    : qname_(intern_(QName(ns, tag)))
+{
+}
+
+
+Atom::Atom(const QName &qname)
+    : qname_(intern_(qname))
+{
+}
+
+
+Atom::Atom(const char *qname)
+    : qname_(intern_(QName(qname)))
+{
+}
+
+
+const QName &
+Atom::qname() const
+{
+    return *qname_;
+}
+
+
+const string &
+Atom::tag() const
+{
+    return qname_->tag();
+}
+
+
+const string &
+Atom::ns() const
+{
+    return qname_->ns();
+}
+
+
+Atom::operator const QName &() const
+{
+    return *qname_;
+}
+
+
+bool
+Atom::operator==(const Atom &other) const
+{
+    return qname_ == other.qname_;
+}
+
+
+bool
+Atom::operator!=(const Atom &other) const
+{
+    return qname_ != other.qname_;
+}
+
+
+// ----------------------
+// XPathContext functions
+// ----------------------
+
+
+XPathValue::XPathValue(const string &s)
+    : type_(STRING)
+    , str_(s)
+    , number_(0)
+{
+}
+
+
+XPathValue::XPathValue(const char *s)
+    : XPathValue(string(s))
+{
+}
+
+
+XPathValue::XPathValue(double n)
+    : type_(NUMBER)
+    , number_(n)
+{
+}
+
+
+XPathValue::XPathValue(int n)
+    : XPathValue(double(n))
+{
+}
+
+
+XPathValue::XPathValue(bool b)
+    : type_(BOOLEAN)
+    , number_(b)
+{
+}
+
+
+XPathValue::value_type
+XPathValue::type() const
+{
+    return type_;
+}
+
+
+const string &
+XPathValue::str() const
+{
+    return str_;
+}
+
+
+double
+XPathValue::number() const
+{
+    return number_;
+}
+
+
+
+static std::vector<Element>
+xpathNodesetToVector_(xmlNodeSet *set)
+{
+    std::vector<Element> out;
+    for(int i = 0; set && i < set->nodeNr; i++) {
+        xmlNode *node = set->nodeTab[i];
+        if(node->type == XML_ELEMENT_NODE) {
+            out.push_back(set->nodeTab[i]);
+        }
+    }
+    return out;
+}
+
+
+XPathContext::~XPathContext()
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    ::xmlXPathFreeContext(context_);
+    context_ = NULL;
+}
+
+
+static string
+nsListKey_(etree::ns_list ns_list)
+{
+    std::sort(ns_list.begin(), ns_list.end());
+
+    string key;
+    for(auto &ns : ns_list) {
+        key += ns.first;
+        key += '=';
+        key += ns.second;
+        key += '\0';
+    }
+    return key;
+}
+
+
+XPathContext::XPathContext(const etree::ns_list &ns_list)
+    : nsKey_(nsListKey_(ns_list))
+{
+    ::xmlResetLastError();
+
+    context_ = xmlXPathNewContext(NULL);
     if(! context_) {
         maybeThrow_();
         throw internal_error();
     }
+    // For call_().
+    context_->userData = this;
+
+    for(auto &ns : ns_list) {
+        auto prefix = toXmlChar_(ns.first.c_str());
+        auto href = toXmlChar_(ns.second.c_str());
+        int rc = ::xmlXPathRegisterNs(context_, prefix, href);
+        if(rc) {
+            ::xmlXPathFreeContext(context_);
+            context_ = NULL;
+            maybeThrow_();
+            throw internal_error();
+        }
+    }
+}
+
+
+static ns_list
+xpathContextToNsList_(const _xmlXPathContext *context_)
+{
+    ns_list ns_list;
+
+    auto callback = [](void *payload, void *data, xmlChar *name) {
+        auto &ns_list = *reinterpret_cast<::etree::ns_list *>(data);
+        ns_list.emplace_back(reinterpret_cast<const char *>(name),
+                             reinterpret_cast<const char *>(payload));
+    };
+
+    auto context = const_cast<_xmlXPathContext *>(context_);
+    ::xmlHashScan(context->nsHash, callback, reinterpret_cast<void *>(&ns_list));
+
+    return ns_list;
+}
+
+
+XPathContext::XPathContext(const XPathContext &other)
+    : XPathContext(xpathContextToNsList_(other.context_))
+{
+    auto callback = [](void *payload, void *data, xmlChar *name) {
+        auto context = reinterpret_cast<_xmlXPathContext *>(data);
+        auto value = ::xmlXPathObjectCopy(
+            reinterpret_cast<xmlXPathObject *>(payload));
+        ::xmlXPathRegisterVariable(context, name, value);
+    };
+
+    auto &otherMtx = const_cast<XPathContext &>(other).mtx_;
+    std::lock_guard<std::mutex> lock(otherMtx);
+    if(other.context_->varHash) {
+        ::xmlHashScan(other.context_->varHash, callback,
+                      reinterpret_cast<void *>(context_));
+    }
+    for(auto &kv : other.funcs_) {
+        function(QName(kv.first.first, kv.first.second), kv.second);
+    }
+}
+
+
+static void
+registerVariable_(xmlXPathContext *context, const string &name,
+                  xmlXPathObject *value)
+{
+    if(! value) {
+        throw memory_error();
+    }
+    if(::xmlXPathRegisterVariable(context, toXmlChar_(name.c_str()), value)) {
+        ::xmlXPathFreeObject(value);
+        throw memory_error();
+    }
+}
+
+
+void
+XPathContext::variable(const string &name, const string &value)
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    registerVariable_(context_, name,
+                      ::xmlXPathNewString(toXmlChar_(value.c_str())));
+}
+
+
+void
+XPathContext::variable(const string &name, double value)
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    registerVariable_(context_, name, ::xmlXPathNewFloat(value));
+}
+
+
+void
+XPathContext::function(const QName &qname, const xpath_function &func)
+{
+    std::lock_guard<std::mutex> lock(mtx_);
+    int rc = ::xmlXPathRegisterFuncNS(context_,
+        toXmlChar_(qname.tag().c_str()), c_str(qname.ns()), call_);
+    if(rc) {
+        throw memory_error();
+    }
+    funcs_[std::make_pair(qname.ns(), qname.tag())] = func;
+}
+
+
+/**
+ * Single libxml2 entry point for every extension function. libxml2 provides
+ * no per-function user data, so the function is found by the name and
+ * namespace libxml2 records on the context while calling it.
+ */
+void
+XPathContext::call_(xmlXPathParserContext *ctxt, int nargs)
+{
+    auto self = static_cast<XPathContext *>(ctxt->context->userData);
+    auto uri = ctxt->context->functionURI;
+    auto key = std::make_pair(string(uri ? toChar_(uri) : ""),
+                              string(toChar_(ctxt->context->function)));
+
+    if(! self) {
+        ::xmlXPathErr(ctxt, XPATH_UNKNOWN_FUNC_ERROR);
+        return;
+    }
+
+    auto it = self->funcs_.find(key);
+    if(it == self->funcs_.end()) {
+        ::xmlXPathErr(ctxt, XPATH_UNKNOWN_FUNC_ERROR);
+        return;
+    }
+
+    std::vector<string> args(nargs);
+    for(int i = nargs; i-- > 0;) {
+        xmlChar *s = ::xmlXPathPopString(ctxt);
+        if(ctxt->error) {
+            ::xmlFree(s);
+            return;
+        }
+        args[i] = toChar_(s);
+        ::xmlFree(s);
+    }
+
+    try {
+        XPathValue value = it->second(args);
+        switch(value.type()) {
+            case XPathValue::STRING:
+                valuePush(ctxt, ::xmlXPathNewString(c_str(value.str())));
+                break;
+            case XPathValue::NUMBER:
+                valuePush(ctxt, ::xmlXPathNewFloat(value.number()));
+                break;
+            case XPathValue::BOOLEAN:
+                valuePush(ctxt, ::xmlXPathNewBoolean(value.number() != 0));
+                break;
+        }
+    } catch(...) {
+        // Exceptions cannot cross libxml2; XPath::eval_() rethrows it.
+        self->error_ = std::current_exception();
+        ::xmlXPathErr(ctxt, XPATH_EXPR_ERROR);
+    }
+}
+
+
+// ----------------------
+// XPathCache functions
+// ----------------------
+
+
+typedef std::shared_ptr<xmlXPathCompExpr> CompExprPtr;
+
+
+struct XPathCacheState_ {
+    typedef std::list<std::pair<string, CompExprPtr>> LruList;
+
+    std::mutex mtx;
+    /// Most recently used entry at the front.
+    LruList lru;
+    std::unordered_map<string, LruList::iterator> map;
+    size_t capacity = 256;
+    size_t hits = 0;
+    size_t misses = 0;
+
+    void trim()
+    {
+        while(lru.size() > capacity) {
+            map.erase(lru.back().first);
+            lru.pop_back();
+        }
+    }
+};
+
+
+/**
+ * Return the process-wide cache. Function-local so that it is constructed
+ * before any static XPath, e.g. those in feed.cpp, tries to use it.
+ */
+static XPathCacheState_ &
+xpathCache_()
+{
+    static XPathCacheState_ cache;
+    return cache;
+}
+
+
+size_t
+XPathCache::capacity()
+{
+    auto &cache = xpathCache_();
+    std::lock_guard<std::mutex> lock(cache.mtx);
+    return cache.capacity;
+}
+
+
+void
+XPathCache::capacity(size_t n)
+{
+    auto &cache = xpathCache_();
+    std::lock_guard<std::mutex> lock(cache.mtx);
+    cache.capacity = n;
+    cache.trim();
+}
+
+
+size_t
+XPathCache::size()
+{
+    auto &cache = xpathCache_();
+    std::lock_guard<std::mutex> lock(cache.mtx);
+    return cache.lru.size();
+}
+
+
+size_t
+XPathCache::hits()
+{
+    auto &cache = xpathCache_();
+    std::lock_guard<std::mutex> lock(cache.mtx);
+    return cache.hits;
+}
+
+
+size_t
+XPathCache::misses()
+{
+    auto &cache = xpathCache_();
+    std::lock_guard<std::mutex> lock(cache.mtx);
+    return cache.misses;
+}
+
+
+void
+XPathCache::clear()
+{
+    auto &cache = xpathCache_();
+    std::lock_guard<std::mutex> lock(cache.mtx);
+    cache.map.clear();
+    cache.lru.clear();
+    cache.hits = 0;
+    cache.misses = 0;
+}
+
+
+// ---------------
+// XPath functions
+// ---------------
+
+
+/**
+ * Fetch a compiled expression from the cache, or compile and insert it. The
+ * compilation happens outside the cache lock; should two threads race to
+ * compile the same expression, the first inserted copy wins.
+ */
+CompExprPtr
+XPath::compile_(const string &s, const XPathContext *context)
+{
+    string key(s);
+    if(context) {
+        key += '\0';
+        key += context->nsKey_;
+    }
+
+    auto &cache = xpathCache_();
+    {
+        std::lock_guard<std::mutex> lock(cache.mtx);
+        auto it = cache.map.find(key);
+        if(it != cache.map.end()) {
+            cache.hits++;
+            cache.lru.splice(cache.lru.begin(), cache.lru, it->second);
+            return it->second->second;
+        }
+        cache.misses++;
+    }
+
+    xmlXPathCompExpr *expr;
+    ::xmlResetLastError();
+    if(context) {
+        auto ctx = const_cast<XPathContext *>(context);
+        std::lock_guard<std::mutex> lock(ctx->mtx_);
+        expr = ::xmlXPathCtxtCompile(ctx->context_, toXmlChar_(s.c_str()));
+    } else {
+        expr = ::xmlXPathCompile(toXmlChar_(s.c_str()));
+    }
+    if(! expr) {
+        maybeThrow_();
+        throw invalid_xpath_error();
+    }
+
+    CompExprPtr ptr(expr, ::xmlXPathFreeCompExpr);
+
+    std::lock_guard<std::mutex> lock(cache.mtx);
+    if(! cache.capacity) {
+        return ptr;
+    }
+
+    auto it = cache.map.find(key);
+    if(it != cache.map.end()) {
+        cache.lru.splice(cache.lru.begin(), cache.lru, it->second);
+        return it->second->second;
+    }
+
+    cache.lru.emplace_front(key, ptr);
+    cache.map[key] = cache.lru.begin();
+    cache.trim();
+    return ptr;
+}
+
+
+XPath::~XPath()
+{
+}
+
+
+XPath::XPath(const string &s)
+    : context_(NULL)
+    , expr_(compile_(s, NULL))
+    , s_(s)
+{
+}
+
+
+XPath::XPath(const char *s)
+    : XPath(string(s))
+{
+}
+
+
+XPath::XPath(const XPath &other)
+    : context_(other.context_)
+    , expr_(other.expr_)
+    , s_(other.s_)
+    , vars_(other.vars_)
+{
+}
+
+
+XPath::XPath(const string &s, const XPathContext &context)
+    : context_(&context)
+    , expr_(compile_(s, &context))
+    , s_(s)
+{
+}
+
+
+const std::string &
+XPath::expr() const
+{
+    return s_;
+}
+
+
+XPath &
+XPath::operator =(const XPath &other)
+{
+    context_ = other.context_;
+    expr_ = other.expr_;
+    s_ = other.s_;
+    vars_ = other.vars_;
+    return *this;
+}
+
+
+XPath
+XPath::bind(const var_list &vars) const
+{
+    XPath out(*this);
+    out.vars_ = std::make_shared<const var_list>(vars);
+    return out;
+}
+
+
+Nullable<Element>
+XPath::find(const Element &e) const
+{
+    XPathResult res = iterfind(e);
+    if(res.empty()) {
+        return Nullable<Element>();
+    }
+    return Nullable<Element>(*res.begin());
+}
+
+
+std::string
+XPath::findtext(const Element &e, const string &default_) const
+{
+    XPathResult res = iterfind(e);
+    if(res.empty()) {
+        return default_;
+    }
+    return (*res.begin()).text();
+}
+
+
+/**
+ * Register the variables bound by XPath::bind() on a context for the lifetime
+ * of the scope, restoring any bindings they shadowed on exit.
+ */
+class VariableScope_
+{
+    xmlXPathContext *context_;
+    const var_list *vars_;
+    std::vector<xmlXPathObject *> saved_;
+
+    public:
+    VariableScope_(xmlXPathContext *context, const var_list *vars)
+        : context_(context)
+        , vars_(vars)
+    {
+        if(! vars_) {
+            return;
+        }
+        try {
+            for(auto &var : *vars_) {
+                auto name = toXmlChar_(var.first.c_str());
+                saved_.push_back(::xmlXPathVariableLookup(context_, name));
+                registerVariable_(context_, var.first,
+                    ::xmlXPathNewString(toXmlChar_(var.second.c_str())));
+            }
+        } catch(...) {
+            restore_();
+            throw;
+        }
+    }
+
+    ~VariableScope_()
+    {
+        if(vars_) {
+            restore_();
+        }
+    }
+
+    private:
+    void restore_()
+    {
+        // Shadowed bindings are restored in reverse, so a name bound twice
+        // ends with its original value.
+        for(size_t i = saved_.size(); i-- > 0;) {
+            auto name = toXmlChar_((*vars_)[i].first.c_str());
+            // A NULL value removes the binding.
+            ::xmlXPathRegisterVariable(context_, name, saved_[i]);
+        }
+        saved_.clear();
+    }
+};
+
+
+xmlXPathObject *
+XPath::eval_(const Element &e) const
+{
+    xmlNode *node = nodeFor__<xmlNode *>(e);
+    xmlXPathObject *res;
+
+    ::xmlResetLastError();
+    if(context_) {
+        auto context = const_cast<XPathContext *>(context_);
+        std::lock_guard<std::mutex> lock(context->mtx_);
+        VariableScope_ scope(context->context_, vars_.get());
+        context->context_->node = node;
+        res = xmlXPathCompiledEval(expr_.get(), context->context_);
+        if(context->error_) {
+            std::exception_ptr error;
+            std::swap(error, context->error_);
+            ::xmlXPathFreeObject(res); // NULL ok.
+            std::rethrow_exception(error);
+        }
+    } else {
+        xmlXPathContext *ctx = xmlXPathNewContext(node->doc);
+        if(! ctx) {
+            throw memory_error();
+        }
+        try {
+            VariableScope_ scope(ctx, vars_.get());
+            ctx->node = node;
+            res = xmlXPathCompiledEval(expr_.get(), ctx);
+        } catch(...) {
+            ::xmlXPathFreeContext(ctx);
+            throw;
+        }
+        ::xmlXPathFreeContext(ctx);
+    }
+
+    if(! res) {
+        maybeThrow_();
+        throw invalid_xpath_error();
+    }
+    return res;
+}
+
+
+std::vector<Element>
+XPath::findall(const Element &e) const
+{
+    xmlXPathObject *res = eval_(e);
+    auto out = xpathNodesetToVector_(res->nodesetval);
+    //::xmlXPathDebugDumpObject(stdout, res, 0);
+    ::xmlXPathFreeObject(res);
+    return out;
+}
+
+
+XPathResult
+XPath::iterfind(const Element &e) const
+{
+    return XPathResult(nodeFor__<xmlNode *>(e), eval_(e));
+}
+
+
+std::vector<Element>
+XPath::removeall(Element &e) const
+{
+    auto elems = findall(e);
+    for(auto &elem : elems) {
+        elem.remove();
+    }
+    return elems;
+}
+
+
+// -------------------
+// LazyXPath functions
+// -------------------
+
+
+const XPath &
+LazyXPath::get() const
+{
+    std::call_once(once_, [&]() {
+        ns_list ns;
+        for(size_t i = 0; i < nsCount_; i++) {
+            ns.emplace_back(ns_[i].first, ns_[i].second);
+        }
+        context_.reset(new XPathContext(ns));
+        expr_.reset(new XPath(s_, *context_));
+    });
+    return *expr_;
+}
+
+
+Nullable<Element>
+LazyXPath::find(const Element &e) const
+{
+    return get().find(e);
+}
+
+
+std::vector<Element>
+LazyXPath::findall(const Element &e) const
+{
+    return get().findall(e);
+}
+
+
+string
+LazyXPath::findtext(const Element &e, const string &default_) const
+{
+    return get().findtext(e, default_);
+}
+
+
+// ---------------------
+// XPathResult functions
+// ---------------------
+
+
+static void
+skipNonElements_(xmlNode **&pos, xmlNode **end)
+{
+    while(pos != end && (*pos)->type != XML_ELEMENT_NODE) {
+        pos++;
+    }
+}
+
+
+XPathIterator::XPathIterator()
+    : pos_(0)
+    , end_(0)
+{
+}
+
+
+XPathIterator::XPathIterator(xmlNode **pos, xmlNode **end)
+    : pos_(pos)
+    , end_(end)
+{
+    skipNonElements_(pos_, end_);
+}
+
+
+XPathIterator &
+XPathIterator::operator++()
+{
+    if(pos_ == end_) {
+        throw out_of_bounds_error();
+    }
+    pos_++;
+    skipNonElements_(pos_, end_);
+    return *this;
+}
+
+
+XPathIterator
+XPathIterator::operator++(int)
+{
+    XPathIterator tmp(*this);
+    operator++();
+    return tmp;
+}
+
+
+bool
+XPathIterator::operator==(const XPathIterator &other) const
+{
+    return pos_ == other.pos_;
+}
+
+
+bool
+XPathIterator::operator!=(const XPathIterator &other) const
+{
+    return pos_ != other.pos_;
+}
+
+
+Element
+XPathIterator::operator*() const
+{
+    assert(pos_ != end_);
+    return Element(*pos_);
+}
+
+
+XPathResult::~XPathResult()
+{
+    unref(node_);
+}
+
+
+XPathResult::XPathResult(xmlNode *node, xmlXPathObject *obj)
+    : node_(ref(node))
+    , obj_(obj, ::xmlXPathFreeObject)
+    , size_(0)
+{
+    xmlNodeSet *set = obj->nodesetval;
+    for(int i = 0; set && i < set->nodeNr; i++) {
+        if(set->nodeTab[i]->type == XML_ELEMENT_NODE) {
+            size_++;
+        }
+    }
+}
+
+
+XPathResult::XPathResult(const XPathResult &other)
+    : node_(ref(other.node_))
+    , obj_(other.obj_)
+    , size_(other.size_)
+{
+}
+
+
+XPathResult &
+XPathResult::operator=(const XPathResult &other)
+{
+    ref(other.node_);
+    unref(node_);
+    node_ = other.node_;
+    obj_ = other.obj_;
+    size_ = other.size_;
+    return *this;
+}
+
+
+XPathIterator
+XPathResult::begin() const
+{
+    xmlNodeSet *set = obj_->nodesetval;
+    if(! set) {
+        return XPathIterator();
+    }
+    return XPathIterator(set->nodeTab, set->nodeTab + set->nodeNr);
+}
+
+
+XPathIterator
+XPathResult::end() const
+{
+    xmlNodeSet *set = obj_->nodesetval;
+    if(! set) {
+        return XPathIterator();
+    }
+    xmlNode **end = set->nodeTab + set->nodeNr;
+    return XPathIterator(end, end);
+}
+
+
+size_t
+XPathResult::size() const
+{
+    return size_;
+}
+
+
+bool
+XPathResult::empty() const
+{
+    return size_ == 0;
+}
+
+
+// ------------------
+// XPathSet functions
+// ------------------
+
+
+static bool
+isNameStartChar_(char c)
+{
+    return ::isalpha(c) || c == '_' || (c & 0x80);
+}
+
+
+static bool
+isNameChar_(char c)
+{
+    return isNameStartChar_(c) || ::isdigit(c) || c == '-' || c == '.';
+}
+
+
+static bool
+isNCName_(const string &s, size_t start, size_t end)
+{
+    if(start == end || !isNameStartChar_(s[start])) {
+        return false;
+    }
+    for(size_t i = start + 1; i < end; i++) {
+        if(! isNameChar_(s[i])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/**
+ * If an expression is a single child step of the form "[./][prefix:]name",
+ * resolve its namespace URI and tag, otherwise leave the step's tag empty.
+ */
+static std::pair<string, string>
+childStep_(const string &expr, xmlXPathContext *context, std::mutex *mtx)
+{
+    std::pair<string, string> step;
+    size_t start = expr.compare(0, 2, "./") ? 0 : 2;
+    size_t colon = expr.find(':', start);
+
+    if(colon == string::npos) {
+        if(isNCName_(expr, start, expr.size())) {
+            step.second = expr.substr(start);
+        }
+    } else if(context
+              && isNCName_(expr, start, colon)
+              && isNCName_(expr, colon + 1, expr.size())) {
+        string prefix = expr.substr(start, colon - start);
+        std::lock_guard<std::mutex> lock(*mtx);
+        const xmlChar *href = ::xmlXPathNsLookup(context,
+            toXmlChar_(prefix.c_str()));
+        if(href) {
+            step.first = toChar_(href);
+            step.second = expr.substr(colon + 1);
+        }
+    }
+    return step;
+}
+
+
+static bool
+stepMatches_(const std::pair<string, string> &step, xmlNode *node)
+{
+    if(step.second.empty() || step.second != toChar_(node->name)) {
+        return false;
+    }
+    return node->ns ? step.first == toChar_(node->ns->href)
+                    : step.first.empty();
+}
+
+
+XPathSet::XPathSet()
+{
+}
+
+
+#ifdef ETREE_0X
+XPathSet::XPathSet(std::initializer_list<XPath> exprs)
+{
+    for(auto &expr : exprs) {
+        add(expr);
+    }
+}
+#endif
+
+
+size_t
+XPathSet::add(const XPath &expr)
+{
+    auto context = const_cast<XPathContext *>(expr.context_);
+    if(context) {
+        steps_.push_back(childStep_(expr.expr(), context->context_,
+                                    &context->mtx_));
+    } else {
+        steps_.push_back(childStep_(expr.expr(), NULL, NULL));
+    }
+    exprs_.push_back(expr);
+    return exprs_.size() - 1;
+}
+
+
+size_t
+XPathSet::size() const
+{
+    return exprs_.size();
+}
+
+
+std::vector<Nullable<Element>>
+XPathSet::find(const Element &e) const
+{
+    std::vector<Nullable<Element>> out(exprs_.size());
+    size_t remain = 0;
+
+    for(size_t i = 0; i < exprs_.size(); i++) {
+        if(steps_[i].second.empty()) {
+            out[i] = exprs_[i].find(e);
+        } else {
+            remain++;
+        }
+    }
+
+    xmlNode *node = nodeFor__<xmlNode *>(e);
+    for(xmlNode *cur = node->children; remain && cur; cur = cur->next) {
+        if(cur->type != XML_ELEMENT_NODE) {
+            continue;
+        }
+        for(size_t i = 0; i < steps_.size(); i++) {
+            if(!out[i] && stepMatches_(steps_[i], cur)) {
+                out[i] = Element(cur);
+                remain--;
+            }
+        }
+    }
+    return out;
+}
+
+
+std::vector<std::vector<Element>>
+XPathSet::findall(const Element &e) const
+{
+    std::vector<std::vector<Element>> out(exprs_.size());
+    bool scan = false;
+
+    for(size_t i = 0; i < exprs_.size(); i++) {
+        if(steps_[i].second.empty()) {
+            out[i] = exprs_[i].findall(e);
+        } else {
+            scan = true;
+        }
+    }
+
+    xmlNode *node = nodeFor__<xmlNode *>(e);
+    for(xmlNode *cur = node->children; scan && cur; cur = cur->next) {
+        if(cur->type != XML_ELEMENT_NODE) {
+            continue;
+        }
+        for(size_t i = 0; i < steps_.size(); i++) {
+            if(stepMatches_(steps_[i], cur)) {
+                out[i].push_back(cur);
+            }
+        }
+    }
+    return out;
+}
+
+
+std::vector<string>
+XPathSet::findtext(const Element &e, const string &default_) const
+{
+    std::vector<string> out;
+    out.reserve(exprs_.size());
+    for(auto &maybe : find(e)) {
+        out.push_back(maybe ? maybe->text() : default_);
+    }
+    return out;
+}
+
+
+// ---------------------
+// ElementPath functions
+// ---------------------
+
+
+typedef std::vector<ElementPathOp> PathOps;
+
+
+class PathParser_
+{
+    const string &s_;
+    const ns_list &namespaces_;
+    size_t i_;
+    PathOps &ops_;
+
+    public:
+    PathParser_(const string &s, const ns_list &namespaces, PathOps &ops)
+        : s_(s), namespaces_(namespaces), i_(0), ops_(ops) {}
+
+    bool parse()
+    {
+        if(s_.empty() || s_[0] == '/') {
+            return false;
+        }
+
+        bool descendant = false;
+        for(;;) {
+            if(! step(descendant)) {
+                return false;
+            }
+            while(peek('[')) {
+                if(! predicate()) {
+                    return false;
+                }
+            }
+            if(i_ == s_.size()) {
+                return true;
+            }
+            if(accept("//")) {
+                descendant = true;
+            } else if(accept("/")) {
+                descendant = false;
+            } else {
+                return false;
+            }
+        }
+    }
+
+    private:
+    bool peek(char c) const
+    {
+        return i_ < s_.size() && s_[i_] == c;
+    }
+
+    bool accept(const char *tok)
+    {
+        size_t n = ::strlen(tok);
+        if(s_.compare(i_, n, tok) == 0) {
+            i_ += n;
+            return true;
+        }
+        return false;
+    }
+
+    bool step(bool descendant)
+    {
+        if(accept("..")) {
+            ops_.push_back(ElementPathOp::PARENT);
+            return !descendant;
+        } else if(accept(".")) {
+            ops_.push_back(ElementPathOp::SELF);
+            return !descendant;
+        }
+        ElementPathOp op(descendant ? ElementPathOp::DESCENDANT
+                                    : ElementPathOp::CHILD);
+        if(! name(op)) {
+            return false;
+        }
+        ops_.push_back(op);
+        return true;
+    }
+
+    bool isNameEnd(char c) const
+    {
+        return ::strchr("/[]=@()'\" ", c) != NULL;
+    }
+
+    bool name(ElementPathOp &op, bool attr=false)
+    {
+        bool braces = accept("{");
+        if(braces) {
+            size_t end = s_.find('}', i_);
+            if(end == string::npos) {
+                return false;
+            }
+            op.ns = s_.substr(i_, end - i_);
+            op.anyNs = (op.ns == "*");
+            i_ = end + 1;
+        } else if(! attr) {
+            // As in Python, the default namespace never applies to attributes.
+            op.ns = lookup("");
+        }
+
+        size_t start = i_;
+        while(i_ < s_.size() && !isNameEnd(s_[i_]) && s_[i_] != '{') {
+            i_++;
+        }
+        op.tag = s_.substr(start, i_ - start);
+
+        size_t colon = op.tag.find(':');
+        if(colon != string::npos && (braces || ! resolve(op, colon))) {
+            return false;
+        }
+
+        if(op.tag == "*") {
+            // "*" alone matches any namespace, "{ns}*" only that one.
+            op.anyTag = true;
+            op.anyNs = op.anyNs || !braces;
+        }
+        return !op.tag.empty();
+    }
+
+    string lookup(const string &prefix) const
+    {
+        for(auto &ns : namespaces_) {
+            if(ns.first == prefix) {
+                return ns.second;
+            }
+        }
+        return "";
+    }
+
+    bool resolve(ElementPathOp &op, size_t colon)
+    {
+        string prefix = op.tag.substr(0, colon);
+        for(auto &ns : namespaces_) {
+            if(ns.first == prefix) {
+                op.ns = ns.second;
+                op.tag = op.tag.substr(colon + 1);
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool quoted(string &out)
+    {
+        if(! (peek('\'') || peek('"'))) {
+            return false;
+        }
+        char quote = s_[i_++];
+        size_t end = s_.find(quote, i_);
+        if(end == string::npos) {
+            return false;
+        }
+        out = s_.substr(i_, end - i_);
+        i_ = end + 1;
+        return true;
+    }
+
+    bool number(long &out)
+    {
+        size_t start = i_;
+        while(i_ < s_.size() && ::isdigit(s_[i_])) {
+            i_++;
+        }
+        if(start == i_) {
+            return false;
+        }
+        out = ::strtol(s_.c_str() + start, NULL, 10);
+        return true;
+    }
+
+    bool predicate()
+    {
+        accept("[");
+        if(accept("@")) {
+            ElementPathOp op(ElementPathOp::HAS_ATTR);
+            if(! name(op, true) || op.anyTag || op.anyNs) {
+                return false;
+            }
+            if(accept("=")) {
+                op.type = ElementPathOp::ATTR_EQUALS;
+                if(! quoted(op.value)) {
+                    return false;
+                }
+            }
+            ops_.push_back(op);
+        } else if(accept("last()")) {
+            ElementPathOp op(ElementPathOp::LAST);
+            if(accept("-") && !number(op.index)) {
+                return false;
+            }
+            ops_.push_back(op);
+        } else if(i_ < s_.size() && ::isdigit(s_[i_])) {
+            ElementPathOp op(ElementPathOp::POSITION);
+            number(op.index);
+            if(op.index < 1) {
+                return false;
+            }
+            ops_.push_back(op);
+        } else if(accept(".=")) {
+            ElementPathOp op(ElementPathOp::TEXT_EQUALS);
+            if(! quoted(op.value)) {
+                return false;
+            }
+            ops_.push_back(op);
+        } else {
+            ElementPathOp op(ElementPathOp::HAS_CHILD);
+            if(! name(op)) {
+                return false;
+            }
+            if(accept("=")) {
+                op.type = ElementPathOp::CHILD_TEXT_EQUALS;
+                if(! quoted(op.value)) {
+                    return false;
+                }
+            }
+            ops_.push_back(op);
+        }
+        return accept("]");
+    }
+};
+
+
+static bool
+parsePath_(const string &s, const ns_list &namespaces, PathOps &ops)
+{
+    PathParser_ parser(s, namespaces, ops);
+    return parser.parse();
+}
+
+
+static bool
+nameMatches_(const ElementPathOp &op, xmlNode *node)
+{
+    if(node->type != XML_ELEMENT_NODE) {
+        return false;
+    }
+    if(!op.anyTag && op.tag != toChar_(node->name)) {
+        return false;
+    }
+    if(op.anyNs) {
+        return true;
+    }
+    return node->ns ? op.ns == toChar_(node->ns->href) : op.ns.empty();
+}
+
+
+static string
+textContent_(xmlNode *node)
+{
+    string out;
+    xmlChar *s = ::xmlNodeGetContent(node);
+    if(s) {
+        out = toChar_(s);
+        ::xmlFree(s);
+    }
+    return out;
+}
+
+
+static bool
+sameName_(xmlNode *a, xmlNode *b)
+{
+    return a->type == XML_ELEMENT_NODE
+        && ::xmlStrEqual(a->name, b->name)
+        && (a->ns == b->ns
+            || (a->ns && b->ns && ::xmlStrEqual(a->ns->href, b->ns->href)));
+}
+
+
+static bool
+predicateMatches_(const ElementPathOp &op, xmlNode *node)
+{
+    switch(op.type) {
+        case ElementPathOp::HAS_ATTR:
+        case ElementPathOp::ATTR_EQUALS: {
+            xmlAttr *attr = ::xmlHasNsProp(node, c_str(op.tag), c_str(op.ns));
+            if(! attr) {
+                return false;
+            }
+            return op.type == ElementPathOp::HAS_ATTR
+                || op.value == textContent_(reinterpret_cast<xmlNode *>(attr));
+        }
+        case ElementPathOp::HAS_CHILD:
+        case ElementPathOp::CHILD_TEXT_EQUALS:
+            for(xmlNode *cur = node->children; cur; cur = cur->next) {
+                if(nameMatches_(op, cur)
+                   && (op.type == ElementPathOp::HAS_CHILD
+                       || op.value == textContent_(cur))) {
+                    return true;
+                }
+            }
+            return false;
+        case ElementPathOp::TEXT_EQUALS:
+            return op.value == textContent_(node);
+        case ElementPathOp::POSITION: {
+            long pos = 1;
+            for(xmlNode *cur = node->prev; cur; cur = cur->prev) {
+                pos += sameName_(cur, node);
+            }
+            return pos == op.index;
+        }
+        case ElementPathOp::LAST: {
+            long following = 0;
+            for(xmlNode *cur = node->next; cur; cur = cur->next) {
+                following += sameName_(cur, node);
+            }
+            return following == op.index;
+        }
+        default:
+            assert(0);
+            return false;
+    }
+}
+
+
+/**
+ * Run the remainder of a program from some instruction against a node,
+ * depth-first, calling func(xmlNode *) for each result until it returns
+ * false. Returns false if evaluation was stopped.
+ */
+template<typename Function>
+static bool
+runPath_(const PathOps &ops, size_t pc, xmlNode *node,
+         std::vector<std::unordered_set<xmlNode *>> &parents,
+         Function &func)
+{
+    if(pc == ops.size()) {
+        return func(node);
+    }
+
+    const ElementPathOp &op = ops[pc];
+    switch(op.type) {
+        case ElementPathOp::SELF:
+            return runPath_(ops, pc + 1, node, parents, func);
+
+        case ElementPathOp::CHILD:
+            for(xmlNode *cur = node->children; cur; cur = cur->next) {
+                if(nameMatches_(op, cur)
+                   && !runPath_(ops, pc + 1, cur, parents, func)) {
+                    return false;
+                }
+            }
+            return true;
+
+        case ElementPathOp::DESCENDANT: {
+            // Pre-order walk of the subtree below node, without recursion.
+            xmlNode *cur = node->children;
+            while(cur) {
+                if(nameMatches_(op, cur)
+                   && !runPath_(ops, pc + 1, cur, parents, func)) {
+                    return false;
+                }
+                if(cur->type == XML_ELEMENT_NODE && cur->children) {
+                    cur = cur->children;
+                    continue;
+                }
+                while(cur != node && !cur->next) {
+                    cur = cur->parent;
+                }
+                cur = (cur == node) ? NULL : cur->next;
+            }
+            return true;
+        }
+
+        case ElementPathOp::PARENT: {
+            xmlNode *parent = node->parent;
+            if(parent && parent->type == XML_ELEMENT_NODE
+               && parents[pc].insert(parent).second) {
+                return runPath_(ops, pc + 1, parent, parents, func);
+            }
+            return true;
+        }
+
+        default:
+            if(predicateMatches_(op, node)) {
+                return runPath_(ops, pc + 1, node, parents, func);
+            }
+            return true;
+    }
+}
+
+
+template<typename Function>
+static void
+runPath_(const PathOps &ops, const Element &e, Function func)
+{
+    std::vector<std::unordered_set<xmlNode *>> parents(ops.size());
+    runPath_(ops, 0, nodeFor__<xmlNode *>(e), parents, func);
+}
+
+
+static Nullable<Element>
+pathFind_(const PathOps &ops, const Element &e)
+{
+    Nullable<Element> out;
+    runPath_(ops, e, [&](xmlNode *node) {
+        out = Element(node);
+        return false;
+    });
+    return out;
+}
+
+
+static std::vector<Element>
+pathFindall_(const PathOps &ops, const Element &e)
+{
+    std::vector<Element> out;
+    runPath_(ops, e, [&](xmlNode *node) {
+        out.push_back(node);
+        return true;
+    });
+    return out;
+}
+
+
+ElementPath::ElementPath(const string &s, const ns_list &namespaces)
+    : s_(s)
+{
+    auto ops = std::make_shared<PathOps>();
+    if(! parsePath_(s, namespaces, *ops)) {
+        throw invalid_path_error();
+    }
+    ops_ = ops;
+}
+
+
+ElementPath::ElementPath(const string &s)
+    : ElementPath(s, ns_list())
+{
+}
+
+
+ElementPath::ElementPath(const char *s)
+    : ElementPath(string(s), ns_list())
+{
+}
+
+
+const string &
+ElementPath::expr() const
+{
+    return s_;
+}
+
+
+Nullable<Element>
+ElementPath::find(const Element &e) const
+{
+    return pathFind_(*ops_, e);
+}
+
+
+std::vector<Element>
+ElementPath::findall(const Element &e) const
+{
+    return pathFindall_(*ops_, e);
+}
+
+
+string
+ElementPath::findtext(const Element &e, const string &default_) const
+{
+    auto maybe = find(e);
+    return maybe ? maybe->text() : default_;
+}
+
+
+// -------------------
+// Attribute functions
+// -------------------
+
+
+/**
+ * Find an attribute by namespace URI and name without allocating. Unlike
+ * xmlHasNsProp(), neither string need be NUL-terminated, and DTD defaults
+ * are not consulted.
+ */
+static xmlAttr *
+findAttr_(xmlNode *node, std::string_view ns, std::string_view tag)
+{
+    for(xmlAttr *attr = node->properties; attr; attr = attr->next) {
+        if(tag == toChar_(attr->name) &&
+           (attr->ns ? ns == toChar_(attr->ns->href) : ns.empty())) {
+            return attr;
+        }
+    }
+    return NULL;
+}
+
+
+/**
+ * Return true if attribute defaults may come from the document's DTD, in
+ * which case lookups missed by findAttr_() must fall back to libxml2.
+ */
+static bool
+hasDtd_(xmlNode *node)
+{
+    return node->doc && node->doc->intSubset;
+}
+
+
+/**
+ * Return a view of an attribute's value. When the value is held in a single
+ * text node, as it almost always is, the view refers to the node's content;
+ * otherwise the nodes are concatenated into buf.
+ */
+static std::string_view
+attrView_(xmlAttr *attr, string &buf)
+{
+    xmlNode *child = attr->children;
+    if(! child) {
+        return std::string_view();
+    } else if(! child->next && child->type == XML_TEXT_NODE) {
+        return toChar_(child->content);
+    }
+
+    xmlChar *s = ::xmlNodeListGetString(attr->doc, child, 1);
+    buf = s ? toChar_(s) : "";
+    ::xmlFree(s);
+    return buf;
+}
+
+
+static string
+attrValue_(xmlAttr *attr)
+{
+    string buf;
+    return string(attrView_(attr, buf));
+}
+
+
+Attribute::Attribute(xmlAttr *attr)
+    : attr_(attr)
+{
+}
+
+
+string
+Attribute::tag() const
+{
+    if(! attr_) {
+        return "";
+    }
+    return (const char *)attr_->name;
+}
+
+
+string
+Attribute::ns() const
+{
+    if(! attr_) {
+        return "";
+    }
+    return attr_->ns ? (const char *)attr_->ns->href : "";
+}
+
+
+QName
+Attribute::qname() const
+{
+    if(attr_) {
+        return QName(ns(), tag());
+    }
+    return QName("", "");
+}
+
+
+string
+Attribute::value() const
+{
+    if(! attr_) {
+        return "";
+    }
+    return attrValue_(attr_);
+}
+
+
+std::string_view
+Attribute::value_view(string &buf) const
+{
+    if(! attr_) {
+        return std::string_view();
+    }
+    return attrView_(attr_, buf);
+}
+
+
+// -----------------
+// AttrMap iterators
+// -----------------
+
+
+AttrIterator::AttrIterator(_xmlNode *node, _xmlAttr *attr)
+    : node_(node)
+    , attr_(attr)
+    , next_(0)
+{
+    if(node_) {
+        ref(node_);
+    }
+    if(attr_) {
+        next_ = attr_->next;
+    }
+}
+
+AttrIterator::AttrIterator()
+    : node_(0)
+    , attr_(0)
+{
+}
+
+
+AttrIterator::~AttrIterator()
+{
+    if(node_) {
+        unref(node_);
+    }
+}
+
+
+bool
+AttrIterator::operator ==(const AttrIterator& other)
+{
+    return attr_ == other.attr_;
+}
+
+
+bool
+AttrIterator::operator !=(const AttrIterator& other)
+{
+    return attr_ != other.attr_;
+}
+
+
+const Attribute
+AttrIterator::operator *()
+{
+    assert(attr_ != NULL);
+    return Attribute(attr_);
+}
+
+
+AttrIterator &
+AttrIterator::operator ++()
+{
+    attr_ = next_;
+    if(attr_) {
+        next_ = attr_->next;
+    }
+    return *this;
+}
+
+
+// -----------------
+// AttrMap functions
+// -----------------
+
+AttrMap::AttrMap(xmlNode *node)
+    : node_(ref(node))
+{
+}
+
+
+AttrMap::~AttrMap()
+{
+    unref(node_);
+}
+
+
+AttrIterator
+AttrMap::begin() const
+{
+    return AttrIterator(node_, node_->properties);
+}
+
+
+AttrIterator
+AttrMap::end() const
+{
+    return AttrIterator();
+}
+
+
+bool
+AttrMap::has(const QName &qname) const
+{
+    return ::xmlHasNsProp(node_, c_str(qname.tag()), c_str(qname.ns()));
+}
+
+
+bool
+AttrMap::has(const char *qname) const
+{
+    return has(QNameView(qname));
+}
+
+
+bool
+AttrMap::has(const QNameView &qname) const
+{
+    return has(qname.ns(), qname.tag());
+}
+
+
+bool
+AttrMap::has(std::string_view ns, std::string_view tag) const
+{
+    if(findAttr_(node_, ns, tag)) {
+        return true;
+    }
+    return hasDtd_(node_) && has(QName(string(ns), string(tag)));
+}
+
+
+string
+AttrMap::get(const QName &qname,
+             const string &default_) const
+{
+    string out(default_);
+    xmlChar *s = ::xmlGetNsProp(node_, c_str(qname.tag()), c_str(qname.ns()));
+
+    if(s) {
+        out = toChar_(s);
+        ::xmlFree(s);
+    }
+    return out;
+}
 
-    for(auto &ns : ns_list) {
-        auto prefix = toXmlChar_(ns.first.c_str());
-        auto href = toXmlChar_(ns.second.c_str());
-        int rc = ::xmlXPathRegisterNs(context_, prefix, href);
-        if(rc) {
-            ::xmlXPathFreeContext(context_);
-            context_ = NULL;
-            maybeThrow_();
-            throw internal_error();
-        }
+
+string
+AttrMap::get(const char *qname, const string &default_) const
+{
+    return get(QNameView(qname), default_);
+}
+
+
+string
+AttrMap::get(const QNameView &qname, const string &default_) const
+{
+    xmlAttr *attr = findAttr_(node_, qname.ns(), qname.tag());
+    if(attr) {
+        return attrValue_(attr);
+    } else if(hasDtd_(node_)) {
+        return get(QName(qname), default_);
     }
+    return default_;
 }
 
 
-static ns_list
-xpathContextToNsList_(const _xmlXPathContext *context_)
+std::string_view
+AttrMap::get_view(const char *qname, string &buf) const
 {
-    ns_list ns_list;
+    return get_view(QNameView(qname), buf);
+}
 
-    auto callback = [](void *payload, void *data, xmlChar *name) {
-        auto &ns_list = *reinterpret_cast<::etree::ns_list *>(data);
-        ns_list.emplace_back(reinterpret_cast<const char *>(name),
-                             reinterpret_cast<const char *>(payload));
-    };
 
-    auto context = const_cast<_xmlXPathContext *>(context_);
-    ::xmlHashScan(context->nsHash, callback, reinterpret_cast<void *>(&ns_list));
+std::string_view
+AttrMap::get_view(const QNameView &qname, string &buf) const
+{
+    xmlAttr *attr = findAttr_(node_, qname.ns(), qname.tag());
+    if(attr) {
+        return attrView_(attr, buf);
+    } else if(hasDtd_(node_)) {
+        buf = get(QName(qname));
+        return buf;
+    }
+    return std::string_view();
+}
 
-    return ns_list;
+
+void
+AttrMap::set(const QName &qname, const string &s)
+{
+    dropIndex_(node_->doc);
+    ::xmlSetNsProp(node_,
+        getNs_(node_, node_, qname.ns()), c_str(qname.tag()), c_str(s));
 }
 
 
-XPathContext::XPathContext(const XPathContext &other)
-    : XPathContext(xpathContextToNsList_(other.context_))
+#ifdef ETREE_0X
+void
+AttrMap::set(kv_list attribs)
 {
+    for(auto &kv : attribs) {
+        set(kv.first, kv.second);
+    }
 }
+#endif
 
 
-// ---------------
-// XPath functions
-// ---------------
+std::vector<QName>
+AttrMap::keys() const
+{
+    std::vector<QName> names;
+    for(xmlAttr *p = node_->properties; p; p = p->next) {
+        const char *ns = p->ns ? (const char *)p->ns->href : "";
+        names.push_back(QName(ns, (const char *)p->name));
+    }
+    return names;
+}
 
 
-XPath::~XPath()
+/**
+ * Describe an attribute as an AttrItem. A multi-node value is assembled into
+ * owned, and item.value then refers to it.
+ */
+static AttrItem
+attrItem_(xmlAttr *attr, string &owned)
 {
-    ::xmlXPathFreeCompExpr(expr_);
+    AttrItem item;
+    item.ns = attr->ns ? toChar_(attr->ns->href) : "";
+    item.tag = toChar_(attr->name);
+    item.value = attrView_(attr, owned);
+    return item;
 }
 
 
-XPath::XPath(const string &s)
-    : context_(NULL)
+std::vector<AttrItem>
+AttrMap::items(string &buf) const
 {
-    ::xmlResetLastError();
-    expr_ = ::xmlXPathCompile(toXmlChar_(s.c_str()));
-    maybeThrow_();
-    s_ = s;
+    std::vector<AttrItem> out;
+    std::vector<std::pair<size_t, size_t>> spans;
+
+    buf.clear();
+    string owned;
+    for(xmlAttr *p = node_->properties; p; p = p->next) {
+        out.push_back(attrItem_(p, owned));
+        if(out.back().value.data() == owned.data()) {
+            spans.emplace_back(out.size() - 1, buf.size());
+            buf += owned;
+            owned.clear();
+        }
+    }
+
+    // buf has stopped growing, so views into it are now stable.
+    for(size_t i = 0; i < spans.size(); i++) {
+        size_t end = (i + 1 < spans.size()) ? spans[i + 1].second : buf.size();
+        out[spans[i].first].value = std::string_view(
+            buf.data() + spans[i].second, end - spans[i].second);
+    }
+    return out;
 }
 
 
-XPath::XPath(const char *s)
-    : XPath(string(s))
+size_t
+AttrMap::retain_if(const std::function<bool(const AttrItem &)> &pred)
+{
+    size_t removed = 0;
+    string owned;
+    xmlAttr *next;
+    for(xmlAttr *p = node_->properties; p; p = next) {
+        next = p->next;
+        if(! pred(attrItem_(p, owned))) {
+            dropIndex_(node_->doc);
+            int rc = ::xmlRemoveProp(p);
+            assert(rc == 0);
+            removed++;
+        }
+    }
+    return removed;
+}
+
+
+bool
+AttrMap::remove(const QName &qname)
 {
+    xmlAttr *p = xmlHasNsProp(node_, c_str(qname.tag()), c_str(qname.ns()));
+    if(p) {
+        dropIndex_(node_->doc);
+        int rc = xmlRemoveProp(p);
+        assert(rc == 0);
+        return true;
+    }
+    return false;
 }
 
 
-XPath::XPath(const XPath &other)
-    : XPath(other.s_)
+size_t
+AttrMap::size() const
 {
+    size_t i = 0;
+    for(xmlAttr *p = node_->properties; p; p = p->next) {
+        i++;
+    }
+    return i;
 }
 
 
-XPath::XPath(const string &s, const XPathContext &context)
-    : XPath(s)
+// ---------------------
+// ElementTree functions
+// ---------------------
+
+
+ElementTree::~ElementTree()
 {
-    context_ = &context;
+    unref(node_);
 }
 
 
-const std::string &
-XPath::expr() const
+ElementTree::ElementTree(_xmlDoc *doc)
+    : node_(ref(doc))
 {
-    return s_;
 }
 
 
-XPath &
-XPath::operator =(const XPath &other)
+ElementTree::ElementTree(const ElementTree &tree)
+    : node_(ref(tree.node_))
 {
-    ::xmlResetLastError();
-    auto newExpr = ::xmlXPathCompile(toXmlChar_(other.s_.c_str()));
-    maybeThrow_();
+}
 
-    ::xmlXPathFreeCompExpr(expr_);
-    expr_ = newExpr;
 
-    s_ = other.s_;
-    return *this;
+Element ElementTree::getroot() const
+{
+    xmlNode *cur = node_->children;
+    bool ok = nextElement_(cur);
+    assert(ok);
+    return Element(cur);
 }
 
 
-Nullable<Element>
-XPath::find(const Element &e) const
+void
+ElementTree::prepare_for_queries()
 {
-    std::vector<Element> out = findall(e);
-    if(out.empty()) {
-        return Nullable<Element>();
+    ::xmlXPathOrderDocElems(node_);
+}
+
+
+std::shared_ptr<const ElementTree>
+ElementTree::snapshot() const
+{
+    xmlDoc *doc = ::xmlCopyDoc(node_, 1);
+    if(! doc) {
+        throw memory_error();
     }
-    return Nullable<Element>(out[0]);
+
+    ElementTree tree(doc);
+    tree.prepare_for_queries();
+    return std::make_shared<const ElementTree>(tree);
 }
 
 
-std::string
-XPath::findtext(const Element &e, const string &default_) const
+void
+ElementTree::build_index(const vector<QName> &keys)
 {
-    std::vector<Element> out = findall(e);
-    if(out.empty()) {
-        return default_;
+    std::unique_ptr<DocIndex_> index(new DocIndex_);
+    for(auto &key : keys) {
+        index->keys.insert(key.tostring());
+    }
+
+    string name;
+    Element root = getroot();
+    xmlNode *rootNode = nodeFor__<xmlNode *>(root);
+    std::vector<xmlNode *> *last = NULL;
+    const xmlChar *lastName = NULL;
+    const xmlNs *lastNs = NULL;
+
+    for(xmlNode *cur = rootNode; cur; cur = nextElementIn_(rootNode, cur)) {
+        // Runs of like-named siblings, common in feeds and archives, share
+        // both pointers in HTML documents and the namespace in XML ones.
+        if(! (last && cur->name == lastName && cur->ns == lastNs)) {
+            universalName_(name, cur->ns, cur->name);
+            last = &index->byName[name];
+            lastName = cur->name;
+            lastNs = cur->ns;
+        }
+        last->push_back(cur);
+
+        if(! index->keys.empty()) {
+            for(xmlAttr *attr = cur->properties; attr; attr = attr->next) {
+                universalName_(name, attr->ns, attr->name);
+                if(index->keys.count(name)) {
+                    string buf;
+                    name += '\0';
+                    name += attrView_(attr, buf);
+                    index->byAttr.emplace(name, cur);
+                }
+            }
+        }
     }
-    return out[0].text();
+
+    dropIndex_(node_);
+    node_->psvi = index.release();
 }
 
 
-std::vector<Element>
-XPath::findall(const Element &e) const
+bool
+ElementTree::indexed() const
 {
-    xmlNode *node = nodeFor__<xmlNode *>(e);
-    xmlXPathObject *res;
+    return indexOf_(node_) != NULL;
+}
 
-    ::xmlResetLastError();
-    if(context_) {
-        auto context = const_cast<XPathContext *>(context_);
-        std::lock_guard<std::mutex> lock(context->mtx_);
-        context->context_->node = node;
-        res = xmlXPathCompiledEval(expr_, context->context_);
-    } else {
-        xmlXPathContext *ctx = xmlXPathNewContext(node->doc);
-        if(! ctx) {
-            throw memory_error();
+
+Nullable<Element>
+ElementTree::find(const QName &qn) const
+{
+    if(DocIndex_ *index = indexOf_(node_)) {
+        auto it = index->byName.find(qn.tostring());
+        if(it == index->byName.end()) {
+            return Nullable<Element>();
         }
-        ctx->node = node;
-        res = xmlXPathCompiledEval(expr_, ctx);
-        ::xmlXPathFreeContext(ctx);
+        return Element(it->second.front());
     }
 
-    if(! res) {
-        maybeThrow_();
+    for(auto e : getroot().iter(qn)) {
+        return e;
     }
-    auto out = xpathNodesetToVector_(res->nodesetval);
-    //::xmlXPathDebugDumpObject(stdout, res, 0);
-    ::xmlXPathFreeObject(res);
-    return out;
+    return Nullable<Element>();
 }
 
 
-std::vector<Element>
-XPath::removeall(Element &e) const
+vector<Element>
+ElementTree::findall(const QName &qn) const
 {
-    auto elems = findall(e);
-    for(auto &elem : elems) {
-        elem.remove();
+    vector<Element> out;
+    if(DocIndex_ *index = indexOf_(node_)) {
+        auto it = index->byName.find(qn.tostring());
+        if(it != index->byName.end()) {
+            out.reserve(it->second.size());
+            for(xmlNode *node : it->second) {
+                out.push_back(Element(node));
+            }
+        }
+        return out;
     }
-    return elems;
-}
 
+    for(auto e : getroot().iter(qn)) {
+        out.push_back(e);
+    }
+    return out;
+}
 
-// -------------------
-// Attribute functions
-// -------------------
 
+Nullable<Element>
+ElementTree::find_by_attr(const QName &attr, const string &value) const
+{
+    string key = attr.tostring();
+    DocIndex_ *index = indexOf_(node_);
+    if(index && index->keys.count(key)) {
+        key += '\0';
+        key += value;
+        auto it = index->byAttr.find(key);
+        if(it == index->byAttr.end()) {
+            return Nullable<Element>();
+        }
+        return Element(it->second);
+    }
 
-Attribute::Attribute(xmlAttr *attr)
-    : attr_(attr)
-{
+    string buf;
+    for(auto e : getroot().iter()) {
+        xmlAttr *p = findAttr_(nodeFor__<xmlNode *>(e), attr.ns(), attr.tag());
+        if(p && attrView_(p, buf) == value) {
+            return e;
+        }
+    }
+    return Nullable<Element>();
 }
 
 
-string
-Attribute::tag() const
+bool
+ElementTree::operator==(const ElementTree &other) const
 {
-    if(! attr_) {
-        return "";
-    }
-    return (const char *)attr_->name;
+    return node_ == other.node_;
 }
 
 
-string
-Attribute::ns() const
+bool
+ElementTree::operator!=(const ElementTree &other) const
 {
-    if(! attr_) {
-        return "";
-    }
-    return attr_->ns ? (const char *)attr_->ns->href : "";
+    return node_ != other.node_;
 }
 
 
-QName
-Attribute::qname() const
+ElementTree &
+ElementTree::operator=(const ElementTree &e)
 {
-    if(attr_) {
-        return QName(ns(), tag());
+    if(e != *this) {
+        unref(node_);
+        node_ = ref(e.node_);
     }
-    return QName("", "");
+    return *this;
 }
 
 
-string
-Attribute::value() const
+// ----------------------
+// TextIterator functions
+// ----------------------
+
+
+/**
+ * Return the text or CDATA node following cur in document order, without
+ * leaving the subtree rooted at root, or NULL if there are no more. Only
+ * elements are descended into, so entity and DTD content is skipped.
+ */
+static xmlNode *
+nextText_(xmlNode *root, xmlNode *cur)
 {
-    if(! attr_) {
-        return "";
-    }
-    string out;
-    auto s = ::xmlNodeGetContent((_xmlNode *) attr_);
-    if(s) {
-        out = toChar_(s);
-        ::xmlFree(s);
+    for(;;) {
+        if(cur->children && (cur == root || cur->type == XML_ELEMENT_NODE)) {
+            cur = cur->children;
+        } else {
+            while(cur != root && ! cur->next) {
+                cur = cur->parent;
+            }
+            if(cur == root) {
+                return NULL;
+            }
+            cur = cur->next;
+        }
+
+        if((cur->type == XML_TEXT_NODE ||
+            cur->type == XML_CDATA_SECTION_NODE) && cur->content) {
+            return cur;
+        }
     }
-    return out;
 }
 
 
-// -----------------
-// AttrMap iterators
-// -----------------
+TextIterator::TextIterator()
+    : root_(NULL)
+    , cur_(NULL)
+{
+}
 
 
-AttrIterator::AttrIterator(_xmlNode *node, _xmlAttr *attr)
-    : node_(node)
-    , attr_(attr)
-    , next_(0)
+TextIterator::TextIterator(xmlNode *root, xmlNode *cur)
+    : root_(root)
+    , cur_(cur)
 {
-    if(node_) {
-        ref(node_);
-    }
-    if(attr_) {
-        next_ = attr_->next;
-    }
 }
 
-AttrIterator::AttrIterator()
-    : node_(0)
-    , attr_(0)
+
+TextIterator
+TextIterator::operator++(int)
 {
+    TextIterator old(*this);
+    ++*this;
+    return old;
 }
 
 
-AttrIterator::~AttrIterator()
+TextIterator &
+TextIterator::operator++()
 {
-    if(node_) {
-        unref(node_);
-    }
+    cur_ = nextText_(root_, cur_);
+    return *this;
 }
 
 
 bool
-AttrIterator::operator ==(const AttrIterator& other)
+TextIterator::operator==(const TextIterator &other) const
 {
-    return attr_ == other.attr_;
+    return cur_ == other.cur_;
 }
 
 
 bool
-AttrIterator::operator !=(const AttrIterator& other)
+TextIterator::operator!=(const TextIterator &other) const
 {
-    return attr_ != other.attr_;
+    return cur_ != other.cur_;
 }
 
 
-const Attribute
-AttrIterator::operator *()
+std::string_view
+TextIterator::operator*() const
 {
-    assert(attr_ != NULL);
-    return Attribute(attr_);
+    return toChar_(cur_->content);
 }
 
 
-AttrIterator &
-AttrIterator::operator ++()
+// -------------------
+// TextRange functions
+// -------------------
+
+
+TextRange::~TextRange()
 {
-    attr_ = next_;
-    if(attr_) {
-        next_ = attr_->next;
-    }
-    return *this;
+    unref(node_);
 }
 
 
-// -----------------
-// AttrMap functions
-// -----------------
-
-AttrMap::AttrMap(xmlNode *node)
+TextRange::TextRange(xmlNode *node)
     : node_(ref(node))
 {
 }
 
 
-AttrMap::~AttrMap()
+TextRange::TextRange(const TextRange &other)
+    : node_(ref(other.node_))
+{
+}
+
+
+TextRange &
+TextRange::operator=(const TextRange &other)
 {
+    ref(other.node_);
     unref(node_);
+    node_ = other.node_;
+    return *this;
 }
 
 
-AttrIterator
-AttrMap::begin() const
+TextIterator
+TextRange::begin() const
 {
-    return AttrIterator(node_, node_->properties);
+    return TextIterator(node_, nextText_(node_, node_));
 }
 
 
-AttrIterator
-AttrMap::end() const
+TextIterator
+TextRange::end() const
 {
-    return AttrIterator();
+    return TextIterator(node_, NULL);
 }
 
 
-bool
-AttrMap::has(const QName &qname) const
+// -------------------------
+// ElementIterator functions
+// -------------------------
+
+
+ElementIterator::ElementIterator()
+    : range_(NULL)
+    , cur_(NULL)
+    , name_(NULL)
+    , nsPtr_(NULL)
+    , nsKnown_(false)
 {
-    return ::xmlHasNsProp(node_, c_str(qname.tag()), c_str(qname.ns()));
 }
 
 
-string
-AttrMap::get(const QName &qname,
-             const string &default_) const
+ElementIterator::ElementIterator(const ElementRange *range, xmlNode *cur)
+    : range_(range)
+    , cur_(cur)
+    , name_(NULL)
+    , nsPtr_(NULL)
+    , nsKnown_(false)
 {
-    string out(default_);
-    xmlChar *s = ::xmlGetNsProp(node_, c_str(qname.tag()), c_str(qname.ns()));
+    if(cur_ && ! matches_(cur_)) {
+        ++*this;
+    }
+}
 
-    if(s) {
-        out = toChar_(s);
-        ::xmlFree(s);
+
+/**
+ * As NameMatcher_, remembering the last name and namespace pointers found to
+ * match, so runs of like-named elements mostly reduce to pointer tests.
+ */
+bool
+ElementIterator::matches_(xmlNode *node)
+{
+    if(! range_->filter_) {
+        return true;
     }
-    return out;
+    if(node->name != name_) {
+        if(range_->tag_ != toChar_(node->name)) {
+            return false;
+        }
+        name_ = node->name;
+    }
+    if(!(nsKnown_ && node->ns == nsPtr_)) {
+        if(node->ns ? range_->ns_ != toChar_(node->ns->href)
+                    : ! range_->ns_.empty()) {
+            return false;
+        }
+        nsPtr_ = node->ns;
+        nsKnown_ = true;
+    }
+    return true;
 }
 
 
-void
-AttrMap::set(const QName &qname, const string &s)
+ElementIterator
+ElementIterator::operator++(int)
 {
-    ::xmlSetNsProp(node_,
-        getNs_(node_, node_, qname.ns()), c_str(qname.tag()), c_str(s));
+    ElementIterator old(*this);
+    ++*this;
+    return old;
 }
 
 
-#ifdef ETREE_0X
-void
-AttrMap::set(kv_list attribs)
+ElementIterator &
+ElementIterator::operator++()
 {
-    for(auto &kv : attribs) {
-        set(kv.first, kv.second);
-    }
+    do {
+        cur_ = nextElementIn_(range_->node_, cur_);
+    } while(cur_ && ! matches_(cur_));
+    return *this;
 }
-#endif
 
 
-std::vector<QName>
-AttrMap::keys() const
+bool
+ElementIterator::operator==(const ElementIterator &other) const
 {
-    std::vector<QName> names;
-    for(xmlAttr *p = node_->properties; p; p = p->next) {
-        const char *ns = p->ns ? (const char *)p->ns->href : "";
-        names.push_back(QName(ns, (const char *)p->name));
-    }
-    return names;
+    return cur_ == other.cur_;
 }
 
 
 bool
-AttrMap::remove(const QName &qname)
+ElementIterator::operator!=(const ElementIterator &other) const
 {
-    xmlAttr *p = xmlHasNsProp(node_, c_str(qname.tag()), c_str(qname.ns()));
-    if(p) {
-        int rc = xmlRemoveProp(p);
-        assert(rc == 0);
-        return true;
-    }
-    return false;
+    return cur_ != other.cur_;
 }
 
 
-size_t
-AttrMap::size() const
+Element
+ElementIterator::operator*() const
 {
-    size_t i = 0;
-    for(xmlAttr *p = node_->properties; p; p = p->next) {
-        i++;
-    }
-    return i;
+    return Element(cur_);
 }
 
 
-// ---------------------
-// ElementTree functions
-// ---------------------
+// ----------------------
+// ElementRange functions
+// ----------------------
 
 
-ElementTree::~ElementTree()
+ElementRange::~ElementRange()
 {
     unref(node_);
 }
 
 
-ElementTree::ElementTree(_xmlDoc *doc)
-    : node_(ref(doc))
+ElementRange::ElementRange(xmlNode *node)
+    : node_(ref(node))
+    , filter_(false)
 {
 }
 
 
-Element ElementTree::getroot() const
+ElementRange::ElementRange(xmlNode *node, std::string_view ns,
+                           std::string_view tag)
+    : node_(ref(node))
+    , filter_(true)
+    , ns_(ns)
+    , tag_(tag)
 {
-    xmlNode *cur = node_->children;
-    bool ok = nextElement_(cur);
-    assert(ok);
-    return Element(cur);
 }
 
 
-bool
-ElementTree::operator==(const ElementTree &other) const
+ElementRange::ElementRange(const ElementRange &other)
+    : node_(ref(other.node_))
+    , filter_(other.filter_)
+    , ns_(other.ns_)
+    , tag_(other.tag_)
 {
-    return node_ == other.node_;
 }
 
 
-bool
-ElementTree::operator!=(const ElementTree &other) const
+ElementRange &
+ElementRange::operator=(const ElementRange &other)
 {
-    return node_ != other.node_;
+    ref(other.node_);
+    unref(node_);
+    node_ = other.node_;
+    filter_ = other.filter_;
+    ns_ = other.ns_;
+    tag_ = other.tag_;
+    return *this;
 }
 
 
-ElementTree &
-ElementTree::operator=(const ElementTree &e)
+ElementIterator
+ElementRange::begin() const
 {
-    if(e != *this) {
-        unref(node_);
-        node_ = ref(e.node_);
-    }
-    return *this;
+    return ElementIterator(this, node_);
+}
+
+
+ElementIterator
+ElementRange::end() const
+{
+    return ElementIterator(this, NULL);
 }
 
 
@@ -1326,6 +3915,7 @@ void
 Element::tag(const string &s)
 {
     assert(! s.empty());
+    dropIndex_(node_->doc);
     ::xmlNodeSetName(node_, c_str(s));
 }
 
@@ -1343,6 +3933,7 @@ Element::ns() const
 void
 Element::ns(const string &ns)
 {
+    dropIndex_(node_->doc);
     if(ns.empty()) {
         node_->ns = NULL;
     } else {
@@ -1365,6 +3956,20 @@ Element::get(const QName &qname, const string &default_) const
 }
 
 
+string
+Element::get(const char *qname, const string &default_) const
+{
+    return attrib().get(QNameView(qname), default_);
+}
+
+
+string
+Element::get(const QNameView &qname, const string &default_) const
+{
+    return attrib().get(qname, default_);
+}
+
+
 Element
 Element::operator[] (size_t i)
 {
@@ -1398,54 +4003,165 @@ Element::operator!=(const Element &e) const
 Element &
 Element::operator=(const Element &e)
 {
-    if(e != *this) {
-        unref(node_);
-        node_ = ref(e.node_);
-    }
-    return *this;
+    if(e != *this) {
+        unref(node_);
+        node_ = ref(e.node_);
+    }
+    return *this;
+}
+
+
+Nullable<Element>
+Element::child() const
+{
+    xmlNode *p = node_->children;
+    if(nextElement_(p)) {
+        return Element(p);
+    }
+    return Nullable<Element>();
+}
+
+
+/**
+ * Match element names against a QName, remembering the last name and
+ * namespace pointers found to match. Siblings usually share a namespace
+ * declared on an ancestor, and HTML documents intern element names in their
+ * dictionary, so while scanning siblings most comparisons reduce to a
+ * pointer test. XML documents are parsed with XML_PARSE_NODICT, so there
+ * only the namespace test benefits.
+ */
+class NameMatcher_ {
+    std::string_view ns_;
+    std::string_view tag_;
+    const xmlChar *name_;
+    const xmlNs *nsPtr_;
+    bool nsKnown_;
+
+    public:
+    NameMatcher_(std::string_view ns, std::string_view tag)
+        : ns_(ns)
+        , tag_(tag)
+        , name_(NULL)
+        , nsPtr_(NULL)
+        , nsKnown_(false)
+    {}
+
+    bool operator()(const xmlNode *node)
+    {
+        if(node->name != name_) {
+            if(tag_ != toChar_(node->name)) {
+                return false;
+            }
+            name_ = node->name;
+        }
+        if(!(nsKnown_ && node->ns == nsPtr_)) {
+            if(node->ns ? ns_ != toChar_(node->ns->href) : ! ns_.empty()) {
+                return false;
+            }
+            nsPtr_ = node->ns;
+            nsKnown_ = true;
+        }
+        return true;
+    }
+};
+
+
+Nullable<Element>
+Element::child(const QName &qn) const
+{
+    return child(QNameView(qn));
+}
+
+
+Nullable<Element>
+Element::child(const char *qname) const
+{
+    return child(QNameView(qname));
+}
+
+
+Nullable<Element>
+Element::child(const QNameView &qn) const
+{
+    return child(qn.ns(), qn.tag());
+}
+
+
+Nullable<Element>
+Element::child(std::string_view ns, std::string_view tag) const
+{
+    NameMatcher_ matches(ns, tag);
+    for(xmlNode *cur = node_->children; cur; cur = cur->next) {
+        if(cur->type == XML_ELEMENT_NODE) {
+            if(matches(cur)) {
+                return Element(cur);
+            }
+        }
+    }
+    return Nullable<Element>();
+}
+
+
+Element
+Element::ensurechild(const QName &qn)
+{
+    auto maybe = child(qn);
+    return maybe ? *maybe : SubElement(*this, qn);
+}
+
+
+Element
+Element::ensurechild(const char *qname)
+{
+    return ensurechild(QNameView(qname));
+}
+
+
+Element
+Element::ensurechild(const QNameView &qn)
+{
+    auto maybe = child(qn);
+    return maybe ? *maybe : SubElement(*this, QName(qn));
+}
+
+
+Element
+Element::ensurechild(std::string_view ns, std::string_view tag)
+{
+    auto maybe = child(ns, tag);
+    return maybe ? *maybe : SubElement(*this, QName(string(ns), string(tag)));
 }
 
 
-Nullable<Element>
-Element::child() const
+std::vector<Element>
+Element::children(const QName &qn) const
 {
-    xmlNode *p = node_->children;
-    if(nextElement_(p)) {
-        return Element(p);
-    }
-    return Nullable<Element>();
+    return children(QNameView(qn));
 }
 
 
-Nullable<Element>
-Element::child(const QName &qn) const
+std::vector<Element>
+Element::children(const char *qname) const
 {
-    for(xmlNode *cur = node_->children; cur; cur = cur->next) {
-        if(cur->type == XML_ELEMENT_NODE) {
-            if(qn.equals(nsToChar_(cur->ns), toChar_(cur->name))) {
-                return Element(cur);
-            }
-        }
-    }
-    return Nullable<Element>();
+    return children(QNameView(qname));
 }
 
 
-Element
-Element::ensurechild(const QName &qn)
+std::vector<Element>
+Element::children(const QNameView &qn) const
 {
-    auto maybe = child(qn);
-    return maybe ? *maybe : SubElement(*this, qn);
+    return children(qn.ns(), qn.tag());
 }
 
 
 std::vector<Element>
-Element::children(const QName &qn) const
+Element::children(std::string_view ns, std::string_view tag) const
 {
     std::vector<Element> out;
+    NameMatcher_ matches(ns, tag);
     for(xmlNode *cur = node_->children; cur; cur = cur->next) {
         if(cur->type == XML_ELEMENT_NODE) {
-            if(qn.equals(nsToChar_(cur->ns), toChar_(cur->name))) {
+            if(matches(cur)) {
                 out.push_back(cur);
             }
         }
@@ -1484,6 +4200,47 @@ Element::copy()
 }
 
 
+/**
+ * Deep copy node into doc without linking it anywhere.
+ */
+static xmlNode *
+copyNode_(xmlNode *node, xmlDoc *doc)
+{
+    xmlNode *newNode = ::xmlDocCopyNode(node, doc, 1);
+    if(! newNode) {
+        throw memory_error();
+    }
+    return newNode;
+}
+
+
+Element
+Element::copy_into(Element &parent) const
+{
+    xmlNode *newNode = copyNode_(node_, parent.node_->doc);
+    dropIndex_(parent.node_->doc);
+    ::xmlAddChild(parent.node_, newNode);
+    reparent_(newNode);
+    return Element(newNode);
+}
+
+
+Element
+Element::copy_before(Element &sibling) const
+{
+    xmlNode *parent = sibling.node_->parent;
+    if(! parent || parent->type != XML_ELEMENT_NODE) {
+        throw out_of_bounds_error();
+    }
+
+    xmlNode *newNode = copyNode_(node_, sibling.node_->doc);
+    dropIndex_(sibling.node_->doc);
+    ::xmlAddPrevSibling(sibling.node_, newNode);
+    reparent_(newNode);
+    return Element(newNode);
+}
+
+
 Nullable<Element>
 Element::find(const XPath &expr) const
 {
@@ -1498,6 +4255,57 @@ Element::findtext(const XPath &expr, const string &default_) const
 }
 
 
+Nullable<Element>
+Element::find(const ElementPath &path) const
+{
+    return path.find(*this);
+}
+
+
+Nullable<Element>
+Element::find(const string &path) const
+{
+    PathOps ops;
+    if(parsePath_(path, ns_list(), ops)) {
+        return pathFind_(ops, *this);
+    }
+    return XPath(path).find(*this);
+}
+
+
+Nullable<Element>
+Element::find(const char *path) const
+{
+    return find(string(path));
+}
+
+
+string
+Element::findtext(const ElementPath &path, const string &default_) const
+{
+    return path.findtext(*this, default_);
+}
+
+
+string
+Element::findtext(const string &path, const string &default_) const
+{
+    PathOps ops;
+    if(parsePath_(path, ns_list(), ops)) {
+        auto maybe = pathFind_(ops, *this);
+        return maybe ? maybe->text() : default_;
+    }
+    return XPath(path).findtext(*this, default_);
+}
+
+
+string
+Element::findtext(const char *path, const string &default_) const
+{
+    return findtext(string(path), default_);
+}
+
+
 std::vector<Element>
 Element::findall(const XPath &expr) const
 {
@@ -1505,6 +4313,38 @@ Element::findall(const XPath &expr) const
 }
 
 
+std::vector<Element>
+Element::findall(const ElementPath &path) const
+{
+    return path.findall(*this);
+}
+
+
+std::vector<Element>
+Element::findall(const string &path) const
+{
+    PathOps ops;
+    if(parsePath_(path, ns_list(), ops)) {
+        return pathFindall_(ops, *this);
+    }
+    return XPath(path).findall(*this);
+}
+
+
+std::vector<Element>
+Element::findall(const char *path) const
+{
+    return findall(string(path));
+}
+
+
+XPathResult
+Element::iterfind(const XPath &expr) const
+{
+    return expr.iterfind(*this);
+}
+
+
 void
 Element::append(Element &e)
 {
@@ -1513,12 +4353,15 @@ Element::append(Element &e)
     }
 
     xmlDoc *sourceDoc = e.node_->doc;
+    xmlNode *oldParent = e.node_->parent;
     xmlNode *next = e.node_->next;
+    dropIndex_(sourceDoc);
+    dropIndex_(node_->doc);
 
     ::xmlUnlinkNode(e.node_);
     ::xmlAddChild(node_, e.node_);
     moveTail_(next, e.node_);
-    reparent_(e.node_);
+    reparent_(e.node_, oldParent);
 
     if(sourceDoc != node_->doc) {
         ref(node_->doc);
@@ -1541,7 +4384,10 @@ Element::insert(size_t i, Element &e)
     }
 
     xmlDoc *sourceDoc = e.node_->doc;
+    xmlNode *oldParent = e.node_->parent;
     xmlNode *next = e.node_->next;
+    dropIndex_(sourceDoc);
+    dropIndex_(node_->doc);
 
     if(child) {
         ::xmlAddPrevSibling(child, e.node_);
@@ -1551,7 +4397,7 @@ Element::insert(size_t i, Element &e)
     }
 
     moveTail_(next, e.node_);
-    reparent_(e.node_);
+    reparent_(e.node_, oldParent);
 
     if(sourceDoc != node_->doc) {
         ref(node_->doc);
@@ -1560,6 +4406,67 @@ Element::insert(size_t i, Element &e)
 }
 
 
+void
+Element::extend(const vector<Element> &elems)
+{
+    vector<xmlNode *> nodes;
+    nodes.reserve(elems.size());
+    for(auto &e : elems) {
+        nodes.push_back(e.node_);
+    }
+    extend_(nodes);
+}
+
+
+void
+Element::extend_(const vector<xmlNode *> &nodes)
+{
+    // Check every source against this element's ancestors before moving any.
+    vector<xmlNode *> ancestors;
+    for(xmlNode *cur = node_; cur; cur = cur->parent) {
+        ancestors.push_back(cur);
+    }
+    std::sort(ancestors.begin(), ancestors.end());
+    for(xmlNode *node : nodes) {
+        if(std::binary_search(ancestors.begin(), ancestors.end(), node)) {
+            throw cyclical_tree_error();
+        }
+    }
+
+    NsReconciler_ nsr(node_);
+    std::unordered_map<xmlDoc *, intptr_t> moves;
+    intptr_t movedIn = 0;
+    dropIndex_(node_->doc);
+
+    for(xmlNode *node : nodes) {
+        xmlDoc *sourceDoc = node->doc;
+        xmlNode *oldParent = node->parent;
+        xmlNode *next = node->next;
+        dropIndex_(sourceDoc);
+
+        ::xmlUnlinkNode(node);
+        ::xmlAddChild(node_, node);
+        moveTail_(next, node);
+        reparent_(nsr, node, oldParent);
+
+        if(sourceDoc != node_->doc) {
+            moves[sourceDoc]++;
+            movedIn++;
+        }
+    }
+
+    if(movedIn) {
+        addRef_(node_->doc, movedIn);
+        for(auto &kv : moves) {
+            if(! addRef_(kv.first, -kv.second)) {
+                dropIndex_(kv.first);
+                ::xmlFreeDoc(kv.first);
+            }
+        }
+    }
+}
+
+
 void
 Element::remove(Element &e)
 {
@@ -1583,6 +4490,7 @@ Element::remove()
 
     xmlDoc *sourceDoc = node_->doc;
     xmlNode *next = node_->next;
+    dropIndex_(sourceDoc);
     ::xmlUnlinkNode(node_);
     ::xmlDocSetRootElement(doc, node_);
     moveTail_(next, node_);
@@ -1605,10 +4513,11 @@ Element::graft()
         throw memory_error();
     }
 
+    dropIndex_(node_->doc);
     xmlNode *lastChild = 0;
     for(xmlNode *cur = node_->children; cur; cur = cur->next) {
         cur->parent = node_->parent;
-        reparent_(cur);
+        reparent_(cur, node_);
         lastChild = cur;
     }
 
@@ -1721,6 +4630,13 @@ Element::text(const string &s)
 }
 
 
+std::string_view
+Element::text_view(string &buf) const
+{
+    return _viewText(node_->children, buf);
+}
+
+
 string
 Element::tail() const
 {
@@ -1728,6 +4644,65 @@ Element::tail() const
 }
 
 
+std::string_view
+Element::tail_view(string &buf) const
+{
+    return _viewText(node_->next, buf);
+}
+
+
+TextRange
+Element::itertext() const
+{
+    return TextRange(node_);
+}
+
+
+ElementRange
+Element::iter() const
+{
+    return ElementRange(node_);
+}
+
+
+ElementRange
+Element::iter(const QName &qn) const
+{
+    return ElementRange(node_, qn.ns(), qn.tag());
+}
+
+
+ElementRange
+Element::iter(const QNameView &qn) const
+{
+    return ElementRange(node_, qn.ns(), qn.tag());
+}
+
+
+ElementRange
+Element::iter(const char *qname) const
+{
+    return iter(QNameView(qname));
+}
+
+
+void
+Element::textcontent(string &out) const
+{
+    size_t size = 0;
+    for(xmlNode *cur = nextText_(node_, node_); cur;
+            cur = nextText_(node_, cur)) {
+        size += ::strlen(toChar_(cur->content));
+    }
+
+    out.reserve(out.size() + size);
+    for(xmlNode *cur = nextText_(node_, node_); cur;
+            cur = nextText_(node_, cur)) {
+        out += toChar_(cur->content);
+    }
+}
+
+
 void
 Element::tail(const string &s)
 {
@@ -1786,57 +4761,251 @@ tostring(const Element &e)
     if(ret == -1) {
         throw serialization_error();
     }
-    return out;
+    return out;
+}
+
+
+string
+tostring(const ElementTree &t)
+{
+    string out;
+    xmlSaveCtxt *ctx = ::xmlSaveToIO(writeCallback, closeCallback,
+        static_cast<void *>(&out), 0, 0);
+
+    auto doc = nodeFor__<xmlDoc *>(t);
+    int ret = ::xmlSaveTree(ctx, reinterpret_cast<xmlNode *>(doc));
+    ::xmlSaveClose(ctx);
+    if(ret == -1) {
+        throw serialization_error();
+    }
+    return out;
+}
+
+
+// ----------------
+// Helper functions
+// ----------------
+
+Element
+SubElement(Element &parent, const QName &qname)
+{
+    auto parentNode = nodeFor__<xmlNode *>(parent);
+    auto tagStr = qname.tag();
+    auto nsCstr = toXmlChar_(tagStr.c_str());
+    auto node = ::xmlNewDocNode(parentNode->doc, 0, nsCstr, 0);
+    dropIndex_(parentNode->doc);
+    ::xmlAddChild(parentNode, node);
+
+    if(qname.ns().size()) {
+        node->ns = getNs_(node, node, qname.ns()); // exceptions
+    }
+
+    return Element(node);
+}
+
+
+#ifdef ETREE_0X
+Element
+SubElement(Element &parent, const QName &qname, kv_list attribs)
+{
+    Element elem = SubElement(parent, qname);
+    attrsFromList_(elem, attribs);
+    return elem;
+}
+#endif
+
+
+// ----------------------
+// visit() implementation
+// ----------------------
+
+
+bool
+visit(const Element &elem, visit_action (*func)(void *ctx, Element &e),
+      void *ctx)
+{
+    xmlNode *root = nodeFor__<xmlNode *>(elem);
+    xmlNode *node = root;
+    for(;;) {
+        xmlNode *parent = node->parent;
+        xmlNode *prev = node->prev;
+        xmlNode *next;
+
+        // Hold a reference until the node's new position has been read, as
+        // func may remove it from the tree.
+        Element e(node);
+        visit_action action = func(ctx, e);
+        if(action == STOP) {
+            return false;
+        }
+
+        if(action == CONTINUE && node->parent == parent
+                && (next = node->children, nextElement_(next))) {
+            node = next;
+            continue;
+        } else if(node == root) {
+            return true;
+        } else if(node->parent != parent) {
+            // Removed or grafted: resume at whatever took its place.
+            next = prev ? prev->next : parent->children;
+        } else {
+            next = node->next;
+        }
+
+        // Find the following element, climbing out of finished subtrees.
+        while(! nextElement_(next)) {
+            if(parent == root) {
+                return true;
+            }
+            next = parent->next;
+            parent = parent->parent;
+        }
+        node = next;
+    }
+}
+
+
+// -------------------------------
+// parallel_visit() implementation
+// -------------------------------
+
+
+/**
+ * One unit of parallel_visit() work: either a single element above the split
+ * point, or a whole subtree below it.
+ */
+struct VisitPart_ {
+    xmlNode *node;
+    bool subtree;
+};
+
+
+/**
+ * Split the tree below root into subtree parts, expanding one level at a time
+ * until there are at least `want`, or the tree runs out of levels. Each
+ * expanded element becomes a single-element part followed by a subtree part
+ * per child, so parts stay in document order.
+ */
+static std::vector<VisitPart_>
+splitParts_(xmlNode *root, size_t want)
+{
+    std::vector<VisitPart_> parts {{root, true}};
+    for(bool grew = true; grew && parts.size() < want; ) {
+        std::vector<VisitPart_> next;
+        grew = false;
+        for(auto &part : parts) {
+            xmlNode *child = part.subtree ? part.node->children : NULL;
+            if(! nextElement_(child)) {
+                next.push_back({part.node, false});
+                continue;
+            }
+
+            next.push_back({part.node, false});
+            for(; nextElement_(child); child = child->next) {
+                next.push_back({child, true});
+                grew = true;
+            }
+        }
+        parts.swap(next);
+    }
+    return parts;
 }
 
 
-string
-tostring(const ElementTree &t)
-{
-    string out;
-    xmlSaveCtxt *ctx = ::xmlSaveToIO(writeCallback, closeCallback,
-        static_cast<void *>(&out), 0, 0);
-
-    auto doc = nodeFor__<xmlDoc *>(t);
-    int ret = ::xmlSaveTree(ctx, reinterpret_cast<xmlNode *>(doc));
-    ::xmlSaveClose(ctx);
-    if(ret == -1) {
-        throw serialization_error();
+bool
+parallel_visit(const Element &root,
+               visit_action (*func)(void *ctx, unsigned worker,
+                                    size_t part, Element &e),
+               void *ctx,
+               unsigned threads)
+{
+    if(! threads) {
+        threads = std::max(1U, std::thread::hardware_concurrency());
     }
-    return out;
-}
 
+    xmlNode *rootNode = nodeFor__<xmlNode *>(root);
+    auto parts = splitParts_(rootNode, threads * 8);
 
-// ----------------
-// Helper functions
-// ----------------
+    // Visit the elements above the split first, noting which were pruned so
+    // the subtrees below them can be dropped.
+    std::unordered_set<xmlNode *> pruned;
+    auto isPruned = [&](xmlNode *node) {
+        for(; node != rootNode; node = node->parent) {
+            if(pruned.count(node->parent)) {
+                return true;
+            }
+        }
+        return false;
+    };
 
-Element
-SubElement(Element &parent, const QName &qname)
-{
-    auto parentNode = nodeFor__<xmlNode *>(parent);
-    auto tagStr = qname.tag();
-    auto nsCstr = toXmlChar_(tagStr.c_str());
-    auto node = ::xmlNewDocNode(parentNode->doc, 0, nsCstr, 0);
-    ::xmlAddChild(parentNode, node);
+    std::vector<size_t> subtrees;
+    for(size_t i = 0; i < parts.size(); i++) {
+        if(isPruned(parts[i].node)) {
+            continue;
+        } else if(parts[i].subtree) {
+            subtrees.push_back(i);
+            continue;
+        }
 
-    if(qname.ns().size()) {
-        node->ns = getNs_(node, node, qname.ns()); // exceptions
+        Element e(parts[i].node);
+        switch(func(ctx, 0, i, e)) {
+            case STOP:
+                return false;
+            case SKIP_CHILDREN:
+                pruned.insert(parts[i].node);
+            case CONTINUE:
+                break;
+        }
     }
 
-    return Element(node);
-}
+    std::atomic<size_t> nextPart(0);
+    std::atomic<bool> stopped(false);
+    std::exception_ptr error;
+    std::mutex errorLock;
+
+    auto work = [&](unsigned worker) {
+        try {
+            while(! stopped) {
+                size_t i = nextPart++;
+                if(i >= subtrees.size()) {
+                    break;
+                }
+
+                size_t part = subtrees[i];
+                bool ok = visit(Element(parts[part].node), [&](Element &e) {
+                    if(stopped.load(std::memory_order_relaxed)) {
+                        return STOP;
+                    }
+                    return func(ctx, worker, part, e);
+                });
+                if(! ok) {
+                    stopped = true;
+                }
+            }
+        } catch(...) {
+            std::lock_guard<std::mutex> guard(errorLock);
+            if(! error) {
+                error = std::current_exception();
+            }
+            stopped = true;
+        }
+    };
 
+    unsigned count = std::min<size_t>(threads, subtrees.size());
+    std::vector<std::thread> pool;
+    for(unsigned worker = 1; worker < count; worker++) {
+        pool.emplace_back(work, worker);
+    }
+    work(0);
+    for(auto &thread : pool) {
+        thread.join();
+    }
 
-#ifdef ETREE_0X
-Element
-SubElement(Element &parent, const QName &qname, kv_list attribs)
-{
-    Element elem = SubElement(parent, qname);
-    attrsFromList_(elem, attribs);
-    return elem;
+    if(error) {
+        std::rethrow_exception(error);
+    }
+    return ! stopped;
 }
-#endif
 
 
 // -------------------------------------
@@ -1956,6 +5125,611 @@ parse(int fd)
 }
 
 
+// --------------------------------------------
+// save_binary() / load_binary() implementation
+// --------------------------------------------
+
+/*
+ * The binary format is a fixed header followed by four arrays and a string
+ * pool, all in native byte order and 4-byte aligned so that a loader may
+ * use the file through a read-only mapping without copying it:
+ *
+ *      BinHeader_
+ *      BinNode_[nodeCount]     Every node below the document, in document
+ *                              order. Elements store the index past their
+ *                              last descendant, giving the tree shape.
+ *      BinAttr_[attrCount]     Attributes, grouped by element.
+ *      BinNs_[nsCount]         Namespace declarations, grouped by element,
+ *                              followed by namespaces used but not declared
+ *                              in the document, such as the xml: prefix.
+ *      uint32_t[stringCount+1] Offset of each string in the pool, plus the
+ *                              end of the pool.
+ *      char[poolSize]          NUL-terminated strings.
+ *
+ * Bump BINARY_VERSION_ whenever the layout changes.
+ */
+
+static const char BINARY_MAGIC_[4] = {'E', 'T', 'R', 'B'};
+static const uint32_t BINARY_VERSION_ = 1;
+static const uint32_t BINARY_BYTE_ORDER_ = 0x01020304;
+static const uint32_t BINARY_NONE_ = UINT32_MAX;
+
+
+struct BinHeader_ {
+    char magic[4];
+    uint32_t version;
+    uint32_t byteOrder;
+    /// String ID of the document encoding, or BINARY_NONE_.
+    uint32_t encoding;
+    uint32_t nodeCount;
+    uint32_t attrCount;
+    uint32_t nsCount;
+    /// Count of BinNs_ records declared by some element.
+    uint32_t nsDeclCount;
+    uint32_t stringCount;
+    uint32_t poolSize;
+};
+
+
+struct BinNode_ {
+    /// libxml2 xmlElementType of the node.
+    uint32_t type;
+    /// Index past the node's last descendant.
+    uint32_t end;
+    /// String ID of the element name or PI target.
+    uint32_t name;
+    /// Index into the BinNs_ array, or BINARY_NONE_.
+    uint32_t ns;
+    /// String ID of text, comment, CDATA or PI content.
+    uint32_t content;
+    /// Index of the node's first attribute.
+    uint32_t attrs;
+    /// Index of the node's first namespace declaration.
+    uint32_t nsDefs;
+};
+
+
+struct BinAttr_ {
+    uint32_t name;
+    uint32_t ns;
+    uint32_t value;
+};
+
+
+struct BinNs_ {
+    /// String ID of the prefix, or BINARY_NONE_ for the default namespace.
+    uint32_t prefix;
+    uint32_t href;
+};
+
+
+/**
+ * Accumulate the records of one document in the order they are written.
+ */
+class BinaryWriter_
+{
+    std::vector<BinNode_> nodes_;
+    std::vector<BinAttr_> attrs_;
+    std::vector<BinNs_> nsDecls_;
+    std::vector<BinNs_> nsExtra_;
+    std::vector<uint32_t> offsets_;
+    string pool_;
+    std::unordered_map<string, uint32_t> strings_;
+    std::unordered_map<const xmlNs *, uint32_t> nsIds_;
+    std::vector<uint32_t> open_;
+
+    uint32_t string_(const xmlChar *s, size_t len)
+    {
+        string key(reinterpret_cast<const char *>(s), len);
+        auto it = strings_.find(key);
+        if(it != strings_.end()) {
+            return it->second;
+        }
+
+        uint32_t id = offsets_.size();
+        offsets_.push_back(pool_.size());
+        pool_.append(key);
+        pool_.push_back('\0');
+        strings_.emplace(std::move(key), id);
+        return id;
+    }
+
+    uint32_t string_(const xmlChar *s)
+    {
+        return s ? string_(s, ::xmlStrlen(s)) : BINARY_NONE_;
+    }
+
+    uint32_t ns_(const xmlNs *ns)
+    {
+        if(! ns) {
+            return BINARY_NONE_;
+        }
+
+        auto it = nsIds_.find(ns);
+        if(it != nsIds_.end()) {
+            return it->second;
+        }
+
+        // Not declared by any element written so far; resolved by href when
+        // loading. Extras are numbered after every declaration in finish().
+        uint32_t id = BINARY_NONE_ - 1 - nsExtra_.size();
+        nsExtra_.push_back({string_(ns->prefix), string_(ns->href)});
+        nsIds_.emplace(ns, id);
+        return id;
+    }
+
+    uint32_t fixNs_(uint32_t id)
+    {
+        if(id != BINARY_NONE_ && id >= nsDecls_.size()) {
+            id = nsDecls_.size() + (BINARY_NONE_ - 1 - id);
+        }
+        return id;
+    }
+
+    public:
+    /// Append a node, returning true if its children should be visited.
+    bool add(xmlNode *node)
+    {
+        BinNode_ rec = {
+            node->type, uint32_t(nodes_.size() + 1), BINARY_NONE_,
+            BINARY_NONE_, BINARY_NONE_, uint32_t(attrs_.size()),
+            uint32_t(nsDecls_.size())
+        };
+
+        switch(node->type) {
+        case XML_ELEMENT_NODE:
+            rec.name = string_(node->name);
+            for(xmlNs *ns = node->nsDef; ns; ns = ns->next) {
+                nsIds_[ns] = nsDecls_.size();
+                nsDecls_.push_back({string_(ns->prefix), string_(ns->href)});
+            }
+            rec.ns = ns_(node->ns);
+            for(xmlAttr *attr = node->properties; attr; attr = attr->next) {
+                xmlChar *s = ::xmlNodeGetContent(
+                    reinterpret_cast<xmlNode *>(attr));
+                attrs_.push_back({string_(attr->name), ns_(attr->ns),
+                                  string_(s ? s : BAD_CAST "")});
+                ::xmlFree(s);
+            }
+            break;
+        case XML_TEXT_NODE:
+        case XML_CDATA_SECTION_NODE:
+        case XML_COMMENT_NODE:
+            rec.content = string_(node->content);
+            break;
+        case XML_PI_NODE:
+            rec.name = string_(node->name);
+            rec.content = string_(node->content);
+            break;
+        case XML_ENTITY_REF_NODE: {
+            xmlChar *s = ::xmlNodeGetContent(node);
+            rec.type = XML_TEXT_NODE;
+            rec.content = string_(s ? s : BAD_CAST "");
+            ::xmlFree(s);
+            break;
+        }
+        default:
+            // DTDs, XIncludes and other node types are not kept.
+            return false;
+        }
+
+        nodes_.push_back(rec);
+        if(node->type == XML_ELEMENT_NODE && node->children) {
+            open_.push_back(nodes_.size() - 1);
+            return true;
+        }
+        return false;
+    }
+
+    /// Close the most recently opened element.
+    void close()
+    {
+        nodes_[open_.back()].end = nodes_.size();
+        open_.pop_back();
+    }
+
+    /// Return the complete file image.
+    string finish(const xmlDoc *doc)
+    {
+        BinHeader_ hdr;
+        ::memcpy(hdr.magic, BINARY_MAGIC_, sizeof hdr.magic);
+        hdr.version = BINARY_VERSION_;
+        hdr.byteOrder = BINARY_BYTE_ORDER_;
+        hdr.encoding = string_(doc->encoding);
+        hdr.nodeCount = nodes_.size();
+        hdr.attrCount = attrs_.size();
+        hdr.nsCount = nsDecls_.size() + nsExtra_.size();
+        hdr.nsDeclCount = nsDecls_.size();
+        hdr.stringCount = offsets_.size();
+        offsets_.push_back(pool_.size());
+        hdr.poolSize = pool_.size();
+
+        for(auto &node : nodes_) {
+            node.ns = fixNs_(node.ns);
+        }
+        for(auto &attr : attrs_) {
+            attr.ns = fixNs_(attr.ns);
+        }
+        nsDecls_.insert(nsDecls_.end(), nsExtra_.begin(), nsExtra_.end());
+
+        string out;
+        out.reserve(sizeof hdr
+                    + (nodes_.size() * sizeof(BinNode_))
+                    + (attrs_.size() * sizeof(BinAttr_))
+                    + (nsDecls_.size() * sizeof(BinNs_))
+                    + (offsets_.size() * sizeof(uint32_t))
+                    + pool_.size());
+        out.append(reinterpret_cast<const char *>(&hdr), sizeof hdr);
+        out.append(reinterpret_cast<const char *>(nodes_.data()),
+                   nodes_.size() * sizeof(BinNode_));
+        out.append(reinterpret_cast<const char *>(attrs_.data()),
+                   attrs_.size() * sizeof(BinAttr_));
+        out.append(reinterpret_cast<const char *>(nsDecls_.data()),
+                   nsDecls_.size() * sizeof(BinNs_));
+        out.append(reinterpret_cast<const char *>(offsets_.data()),
+                   offsets_.size() * sizeof(uint32_t));
+        out.append(pool_);
+        return out;
+    }
+};
+
+
+void
+ElementTree::save_binary(int fd) const
+{
+    BinaryWriter_ writer;
+    xmlNode *docNode = reinterpret_cast<xmlNode *>(node_);
+
+    // Iterative, so hostile nesting depth cannot exhaust the stack.
+    for(xmlNode *cur = node_->children; cur; ) {
+        if(writer.add(cur)) {
+            cur = cur->children;
+            continue;
+        }
+        while(! cur->next && cur->parent != docNode) {
+            cur = cur->parent;
+            writer.close();
+        }
+        cur = cur->next;
+    }
+
+    string out = writer.finish(node_);
+    for(size_t done = 0; done < out.size(); ) {
+        ssize_t ret = ::write(fd, out.data() + done, out.size() - done);
+        if(ret == -1 && errno != EINTR) {
+            throw serialization_error();
+        } else if(ret > 0) {
+            done += ret;
+        }
+    }
+}
+
+
+/**
+ * Validate a file image produced by ElementTree::save_binary() and build a
+ * libxml2 document from it, throwing parse_error on any inconsistency.
+ */
+class BinaryReader_
+{
+    const char *p_;
+    size_t size_;
+    BinHeader_ hdr_;
+    const BinNode_ *nodes_;
+    const BinAttr_ *attrs_;
+    const BinNs_ *nsRecs_;
+    const uint32_t *offsets_;
+    const char *pool_;
+    xmlDoc *doc_;
+    /// Namespace created for each declaration, in scope until nsEnd_.
+    std::vector<xmlNs *> nsPtrs_;
+    std::vector<uint32_t> nsEnd_;
+
+    static void fail_()
+    {
+        throw parse_error();
+    }
+
+    template<typename T>
+    const T *array_(size_t &pos, uint32_t count)
+    {
+        const T *out = reinterpret_cast<const T *>(p_ + pos);
+        if(count > (size_ - pos) / sizeof(T)) {
+            fail_();
+        }
+        pos += count * sizeof(T);
+        return out;
+    }
+
+    const xmlChar *str_(uint32_t id) const
+    {
+        if(id >= hdr_.stringCount) {
+            fail_();
+        }
+        return BAD_CAST (pool_ + offsets_[id]);
+    }
+
+    int len_(uint32_t id) const
+    {
+        str_(id);
+        return offsets_[id + 1] - offsets_[id] - 1;
+    }
+
+    xmlNs *ns_(uint32_t id, uint32_t index, xmlNode *node)
+    {
+        if(id == BINARY_NONE_) {
+            return NULL;
+        } else if(id >= hdr_.nsCount) {
+            fail_();
+        } else if(id < hdr_.nsDeclCount) {
+            // Only declarations on this element or an ancestor are in scope.
+            if(! nsPtrs_[id] || index >= nsEnd_[id]) {
+                fail_();
+            }
+            return nsPtrs_[id];
+        }
+
+        const BinNs_ &rec = nsRecs_[id];
+        const xmlChar *prefix = (rec.prefix == BINARY_NONE_)
+            ? NULL : str_(rec.prefix);
+        xmlNs *ns = ::xmlSearchNsByHref(doc_, node, str_(rec.href));
+        if(! ns) {
+            ns = ::xmlNewNs(node, str_(rec.href), prefix);
+        }
+        if(! ns) {
+            fail_();
+        }
+        return ns;
+    }
+
+    static void link_(xmlNode *parent, xmlNode *node)
+    {
+        node->parent = parent;
+        node->prev = parent->last;
+        if(parent->last) {
+            parent->last->next = node;
+        } else {
+            parent->children = node;
+        }
+        parent->last = node;
+    }
+
+    xmlNode *element_(uint32_t index, xmlNode *parent)
+    {
+        const BinNode_ &rec = nodes_[index];
+        xmlNode *node = ::xmlNewDocNode(doc_, NULL, str_(rec.name), NULL);
+        if(! node) {
+            throw memory_error();
+        }
+        // Linked first so the document frees it if validation fails below.
+        link_(parent, node);
+
+        uint32_t nsDefsEnd = (index + 1 < hdr_.nodeCount)
+            ? nodes_[index + 1].nsDefs : hdr_.nsDeclCount;
+        if(rec.nsDefs > nsDefsEnd || nsDefsEnd > hdr_.nsDeclCount) {
+            fail_();
+        }
+        for(uint32_t i = rec.nsDefs; i < nsDefsEnd; i++) {
+            const xmlChar *prefix = (nsRecs_[i].prefix == BINARY_NONE_)
+                ? NULL : str_(nsRecs_[i].prefix);
+            nsPtrs_[i] = ::xmlNewNs(node, str_(nsRecs_[i].href), prefix);
+            nsEnd_[i] = rec.end;
+            if(! nsPtrs_[i]) {
+                fail_();
+            }
+        }
+        return node;
+    }
+
+    void attrs_of_(uint32_t index, xmlNode *node)
+    {
+        const BinNode_ &rec = nodes_[index];
+        uint32_t attrsEnd = (index + 1 < hdr_.nodeCount)
+            ? nodes_[index + 1].attrs : hdr_.attrCount;
+        if(rec.attrs > attrsEnd || attrsEnd > hdr_.attrCount) {
+            fail_();
+        }
+        for(uint32_t i = rec.attrs; i < attrsEnd; i++) {
+            const BinAttr_ &attr = attrs_[i];
+            if(! ::xmlNewNsProp(node, ns_(attr.ns, index, node),
+                                str_(attr.name), str_(attr.value))) {
+                throw memory_error();
+            }
+        }
+    }
+
+    xmlNode *node_(uint32_t index)
+    {
+        const BinNode_ &rec = nodes_[index];
+        xmlNode *node = NULL;
+        switch(rec.type) {
+        case XML_TEXT_NODE:
+            node = ::xmlNewDocTextLen(doc_, str_(rec.content),
+                                      len_(rec.content));
+            break;
+        case XML_CDATA_SECTION_NODE:
+            node = ::xmlNewCDataBlock(doc_, str_(rec.content),
+                                      len_(rec.content));
+            break;
+        case XML_COMMENT_NODE:
+            node = ::xmlNewDocComment(doc_, str_(rec.content));
+            break;
+        case XML_PI_NODE:
+            node = ::xmlNewDocPI(doc_, str_(rec.name), str_(rec.content));
+            break;
+        default:
+            fail_();
+        }
+        if(! node) {
+            throw memory_error();
+        }
+        return node;
+    }
+
+    public:
+    BinaryReader_(const char *p, size_t size)
+        : p_(p)
+        , size_(size)
+        , doc_(NULL)
+    {
+        if(size < sizeof hdr_) {
+            fail_();
+        }
+        ::memcpy(&hdr_, p, sizeof hdr_);
+        if(::memcmp(hdr_.magic, BINARY_MAGIC_, sizeof hdr_.magic)
+                || hdr_.version != BINARY_VERSION_
+                || hdr_.byteOrder != BINARY_BYTE_ORDER_
+                || hdr_.nsDeclCount > hdr_.nsCount
+                || hdr_.stringCount == BINARY_NONE_) {
+            fail_();
+        }
+
+        size_t pos = sizeof hdr_;
+        nodes_ = array_<BinNode_>(pos, hdr_.nodeCount);
+        attrs_ = array_<BinAttr_>(pos, hdr_.attrCount);
+        nsRecs_ = array_<BinNs_>(pos, hdr_.nsCount);
+        offsets_ = array_<uint32_t>(pos, hdr_.stringCount + 1);
+        pool_ = p_ + pos;
+        if(hdr_.poolSize != size_ - pos) {
+            fail_();
+        }
+
+        // Every string must be NUL-terminated within the pool.
+        if(offsets_[0] != 0 || offsets_[hdr_.stringCount] != hdr_.poolSize) {
+            fail_();
+        }
+        for(uint32_t i = 0; i < hdr_.stringCount; i++) {
+            if(offsets_[i + 1] <= offsets_[i]
+                    || offsets_[i + 1] > hdr_.poolSize
+                    || pool_[offsets_[i + 1] - 1] != '\0') {
+                fail_();
+            }
+        }
+    }
+
+    /// Build the document. The caller owns the result.
+    xmlDoc *load()
+    {
+        std::unique_ptr<xmlDoc, void (*)(xmlDoc *)> owner(
+            ::xmlNewDoc(BAD_CAST "1.0"), ::xmlFreeDoc);
+        doc_ = owner.get();
+        if(! doc_) {
+            throw memory_error();
+        }
+        if(hdr_.encoding != BINARY_NONE_) {
+            doc_->encoding = ::xmlStrdup(str_(hdr_.encoding));
+        }
+
+        nsPtrs_.assign(hdr_.nsDeclCount, NULL);
+        nsEnd_.assign(hdr_.nsDeclCount, 0);
+
+        xmlNode *parent = reinterpret_cast<xmlNode *>(doc_);
+        uint32_t parentEnd = hdr_.nodeCount;
+        std::vector<std::pair<xmlNode *, uint32_t>> stack;
+        bool haveRoot = false;
+
+        for(uint32_t i = 0; i < hdr_.nodeCount; i++) {
+            while(i == parentEnd) {
+                parent = stack.back().first;
+                parentEnd = stack.back().second;
+                stack.pop_back();
+            }
+
+            const BinNode_ &rec = nodes_[i];
+            if(rec.type != XML_ELEMENT_NODE) {
+                if(rec.end != i + 1) {
+                    fail_();
+                }
+                link_(parent, node_(i));
+                continue;
+            }
+
+            if(rec.end <= i || rec.end > parentEnd) {
+                fail_();
+            } else if(stack.empty()) {
+                if(haveRoot) {
+                    fail_();
+                }
+                haveRoot = true;
+            }
+
+            xmlNode *node = element_(i, parent);
+            node->ns = ns_(rec.ns, i, node);
+            attrs_of_(i, node);
+
+            if(rec.end > i + 1) {
+                stack.emplace_back(parent, parentEnd);
+                parent = node;
+                parentEnd = rec.end;
+            }
+        }
+
+        if(! haveRoot) {
+            fail_();
+        }
+        return owner.release();
+    }
+};
+
+
+ElementTree
+load_binary(int fd)
+{
+    struct stat st;
+    if(::fstat(fd, &st) == -1) {
+        throw parse_error();
+    }
+
+    size_t size = st.st_size;
+    void *p = (size && S_ISREG(st.st_mode))
+        ? ::mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0)
+        : MAP_FAILED;
+
+    if(p == MAP_FAILED) {
+        // Pipes and the like: read everything instead.
+        string buf;
+        char chunk[65536];
+        ssize_t ret;
+        while((ret = ::read(fd, chunk, sizeof chunk)) != 0) {
+            if(ret == -1 && errno != EINTR) {
+                throw parse_error();
+            } else if(ret > 0) {
+                buf.append(chunk, ret);
+            }
+        }
+        return ElementTree(BinaryReader_(buf.data(), buf.size()).load());
+    }
+
+    try {
+        ElementTree tree(
+            BinaryReader_(static_cast<const char *>(p), size).load());
+        ::munmap(p, size);
+        return tree;
+    } catch(...) {
+        ::munmap(p, size);
+        throw;
+    }
+}
+
+
+ElementTree
+load_binary(const string &path)
+{
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd == -1) {
+        throw parse_error();
+    }
+
+    try {
+        ElementTree tree = load_binary(fd);
+        ::close(fd);
+        return tree;
+    } catch(...) {
+        ::close(fd);
+        throw;
+    }
+}
+
+
 // ---------------------
 // etree::html namespace
 // ---------------------
@@ -2053,6 +5827,11 @@ operator<< (ostream& out, const QName& qname)
 namespace std {
     size_t hash<etree::QName>::operator()(const etree::QName &x) const
     {
-        return hash<std::string>()(x.tag()) ^ (hash<std::string>()(x.ns()) << 1);
+        return x.hash();
+    }
+
+    size_t hash<etree::Atom>::operator()(const etree::Atom &x) const
+    {
+        return hash<const etree::QName *>()(&x.qname());
     }
 } // namespace
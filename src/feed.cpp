@@ -22,46 +22,46 @@ namespace feed {
 #define DUBLIN_CORE_NS "http://purl.org/dc/elements/1.1/"
 #define ATOM_NS "http://www.w3.org/2005/Atom"
 
-static const XPathContext kContext(ns_list{
+static constexpr ns_literal kNamespaces[] = {
     {"atom", ATOM_NS},
     {"dc", DUBLIN_CORE_NS}
-});
+};
 
 #define ATOM_LINK_PATH "atom:link[@rel='alternate' and @type='text/html']"
 
-static const QName kAtomAuthorTag(ATOM_NS, "author");
-static const QName kAtomContentTag(ATOM_NS, "content");
-static const QName kAtomEntryTag(ATOM_NS, "entry");
-static const QName kAtomFeedTag(ATOM_NS, "feed");
-static const QName kAtomIconTag(ATOM_NS, "icon");
-static const QName kAtomIdTag(ATOM_NS, "id");
-static const QName kAtomLinkTag(ATOM_NS, "link");
-static const QName kAtomNameTag(ATOM_NS, "name");
-static const QName kAtomOriginalGuidAttr(READER_NS, "original-id");
-static const QName kAtomPublishedTag(ATOM_NS, "published");
-static const QName kAtomRootTag(ATOM_NS, "feed");
-static const QName kAtomSubtitleTag(ATOM_NS, "subtitle");
-static const QName kAtomSummaryTag(ATOM_NS, "summary");
-static const QName kAtomTitleTag(ATOM_NS, "title");
-static const QName kAtomUpdatedTag(ATOM_NS, "updated");
-static const XPath kAtomAuthorPath("atom:author/atom:name", kContext);
-static const XPath kAtomContentPath("atom:content", kContext);
-static const XPath kAtomEntryPath("atom:entry", kContext);
-static const XPath kAtomGuidPath("atom:id", kContext);
-static const XPath kAtomIconPath("atom:icon | atom:image", kContext);
-static const XPath kAtomLinkPath(ATOM_LINK_PATH, kContext);
-static const XPath kAtomPublishedPath("atom:published", kContext);
-static const XPath kAtomSubtitlePath("atom:subtitle", kContext);
-static const XPath kAtomTitlePath("atom:title", kContext);
-static const XPath kAtomUpdatedPath("atom:updated", kContext);
-static const XPath kDublinCoreCreatorPath("dc:creator", kContext);
-static const XPath kRssIconPath("channel/image/url");
-static const XPath kRssItemContentPath("description");
-static const XPath kRssItemGuidPath("guid");
-static const XPath kRssItemsPath("channel/item");
-static const XPath kRssLinkPath("link");
-static const XPath kRssPublishedPath("pubDate");
-static const XPath kRssTitlePath("title");
+static constexpr QNameView kAtomAuthorTag("{" ATOM_NS "}author");
+static constexpr QNameView kAtomContentTag("{" ATOM_NS "}content");
+static constexpr QNameView kAtomEntryTag("{" ATOM_NS "}entry");
+static constexpr QNameView kAtomFeedTag("{" ATOM_NS "}feed");
+static constexpr QNameView kAtomIconTag("{" ATOM_NS "}icon");
+static constexpr QNameView kAtomIdTag("{" ATOM_NS "}id");
+static constexpr QNameView kAtomLinkTag("{" ATOM_NS "}link");
+static constexpr QNameView kAtomNameTag("{" ATOM_NS "}name");
+static constexpr QNameView kAtomOriginalGuidAttr("{" READER_NS "}original-id");
+static constexpr QNameView kAtomPublishedTag("{" ATOM_NS "}published");
+static constexpr QNameView kAtomRootTag("{" ATOM_NS "}feed");
+static constexpr QNameView kAtomSubtitleTag("{" ATOM_NS "}subtitle");
+static constexpr QNameView kAtomSummaryTag("{" ATOM_NS "}summary");
+static constexpr QNameView kAtomTitleTag("{" ATOM_NS "}title");
+static constexpr QNameView kAtomUpdatedTag("{" ATOM_NS "}updated");
+static const LazyXPath kAtomAuthorPath("atom:author/atom:name", kNamespaces);
+static const LazyXPath kAtomContentPath("atom:content", kNamespaces);
+static const LazyXPath kAtomEntryPath("atom:entry", kNamespaces);
+static const LazyXPath kAtomGuidPath("atom:id", kNamespaces);
+static const LazyXPath kAtomIconPath("atom:icon | atom:image", kNamespaces);
+static const LazyXPath kAtomLinkPath(ATOM_LINK_PATH, kNamespaces);
+static const LazyXPath kAtomPublishedPath("atom:published", kNamespaces);
+static const LazyXPath kAtomSubtitlePath("atom:subtitle", kNamespaces);
+static const LazyXPath kAtomTitlePath("atom:title", kNamespaces);
+static const LazyXPath kAtomUpdatedPath("atom:updated", kNamespaces);
+static const LazyXPath kDublinCoreCreatorPath("dc:creator", kNamespaces);
+static const LazyXPath kRssIconPath("channel/image/url");
+static const LazyXPath kRssItemContentPath("description");
+static const LazyXPath kRssItemGuidPath("guid");
+static const LazyXPath kRssItemsPath("channel/item");
+static const LazyXPath kRssLinkPath("link");
+static const LazyXPath kRssPublishedPath("pubDate");
+static const LazyXPath kRssTitlePath("title");
 
 
 // ----------------
@@ -331,7 +331,7 @@ class AtomItemFormat
 
     Nullable<Element> getContentTag_(const Element &e) const
     {
-        static const std::vector<const QName *> tags = {
+        static constexpr const QNameView *tags[] = {
             &kAtomContentTag,
             &kAtomSummaryTag
         };
@@ -543,7 +543,7 @@ struct AtomFeedFormat
 
 
 static string
-channelFindText_(const Element &e, const XPath &xp)
+channelFindText_(const Element &e, const LazyXPath &xp)
 {
     auto maybe = e.child("channel");
     if(maybe) {
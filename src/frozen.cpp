@@ -0,0 +1,796 @@
+/*
+ * Copyright David Wilson, 2013.
+ * License: http://opensource.org/licenses/MIT
+ */
+
+#include <cassert>
+#include <cctype>
+#include <cstring>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+
+#include <libxml/xmlerror.h>
+#include <libxml/xmlreader.h>
+
+#include <elementtree/frozen.hpp>
+
+
+namespace etree {
+
+
+typedef std::vector<ElementPathOp> PathOps;
+
+
+static const char *
+toChar_(const xmlChar *s)
+{
+    return reinterpret_cast<const char *>(s);
+}
+
+
+static std::string_view
+view_(const xmlChar *s)
+{
+    return s ? std::string_view(toChar_(s)) : std::string_view();
+}
+
+
+// ------------------------
+// FrozenBuilder_ functions
+// ------------------------
+
+
+/**
+ * Accumulates a FrozenTree from a stream of start, attribute, text and end
+ * events in document order.
+ */
+class FrozenBuilder_
+{
+    /// Strings no longer than this are interned; longer text is rarely
+    /// repeated, so hashing it only slows construction.
+    enum { INTERN_MAX = 64 };
+
+    FrozenTree &tree_;
+    std::unordered_map<string, uint32_t> interned_;
+    std::unordered_map<uint64_t, uint32_t> names_;
+    /// Open elements.
+    std::vector<uint32_t> stack_;
+
+    /// Pending text run, and the string ID it is assigned to when complete.
+    string run_;
+    uint32_t *runTarget_;
+
+    uint32_t addString_(std::string_view s)
+    {
+        if(s.empty()) {
+            return 0;
+        }
+
+        bool intern = s.size() <= INTERN_MAX;
+        if(intern) {
+            auto it = interned_.find(string(s));
+            if(it != interned_.end()) {
+                return it->second;
+            }
+        }
+
+        uint32_t id = tree_.strings_.size() - 1;
+        tree_.pool_.append(s.data(), s.size());
+        tree_.strings_.push_back(tree_.pool_.size());
+        if(intern) {
+            interned_.emplace(string(s), id);
+        }
+        return id;
+    }
+
+    uint32_t addName_(std::string_view ns, std::string_view tag)
+    {
+        uint64_t key = uint64_t(addString_(ns)) << 32 | addString_(tag);
+        auto it = names_.find(key);
+        if(it != names_.end()) {
+            return it->second;
+        }
+
+        uint32_t id = tree_.names_.size();
+        tree_.names_.push_back({uint32_t(key >> 32), uint32_t(key)});
+        names_.emplace(key, id);
+        return id;
+    }
+
+    void flush_()
+    {
+        if(runTarget_ && run_.size()) {
+            *runTarget_ = addString_(run_);
+        }
+        run_.clear();
+        runTarget_ = NULL;
+    }
+
+    public:
+    FrozenBuilder_(FrozenTree &tree)
+        : tree_(tree)
+        , runTarget_(NULL)
+    {
+        // String 0 is the empty string.
+        tree_.strings_.push_back(0);
+        tree_.strings_.push_back(0);
+    }
+
+    void start(std::string_view ns, std::string_view tag)
+    {
+        flush_();
+        uint32_t index = tree_.nodes_.size();
+        uint32_t parent = stack_.size() ? stack_.back() : FrozenTree::NONE;
+        tree_.nodes_.push_back({
+            addName_(ns, tag), parent, 0, 0, 0, uint32_t(tree_.attrs_.size())
+        });
+        stack_.push_back(index);
+        runTarget_ = &tree_.nodes_.back().text;
+    }
+
+    void attr(std::string_view ns, std::string_view tag, std::string_view value)
+    {
+        tree_.attrs_.push_back({addName_(ns, tag), addString_(value)});
+    }
+
+    /**
+     * Append to the current text run, if any.
+     */
+    void text(std::string_view s)
+    {
+        if(runTarget_) {
+            run_.append(s.data(), s.size());
+        }
+    }
+
+    /**
+     * End the current text run without starting another.
+     */
+    void interrupt()
+    {
+        flush_();
+    }
+
+    void end()
+    {
+        flush_();
+        uint32_t index = stack_.back();
+        stack_.pop_back();
+        tree_.nodes_[index].end = tree_.nodes_.size();
+        if(stack_.size()) {
+            // The root's tail is never kept.
+            runTarget_ = &tree_.nodes_[index].tail;
+        }
+    }
+
+    void finish()
+    {
+        flush_();
+        if(tree_.nodes_.empty() || stack_.size()) {
+            throw parse_error();
+        }
+        tree_.nodes_.shrink_to_fit();
+        tree_.attrs_.shrink_to_fit();
+        tree_.names_.shrink_to_fit();
+        tree_.strings_.shrink_to_fit();
+        tree_.pool_.shrink_to_fit();
+    }
+};
+
+
+static void
+buildFromElement_(FrozenBuilder_ &b, const Element &e, string &buf)
+{
+    QName qn = e.qname();
+    b.start(qn.ns(), qn.tag());
+    for(auto &item : e.attrib().items(buf)) {
+        b.attr(item.ns, item.tag, item.value);
+    }
+    b.text(e.text_view(buf));
+    b.interrupt();
+
+    for(auto child : e) {
+        buildFromElement_(b, child, buf);
+        b.text(child.tail_view(buf));
+        b.interrupt();
+    }
+    b.end();
+}
+
+
+static void
+maybeThrow_()
+{
+    xmlError *error = ::xmlGetLastError();
+    if(error) {
+        std::string s(error->message);
+        while(s.size() && ::isspace(s[s.size() - 1])) {
+            s.pop_back();
+        }
+        throw xml_error(s.c_str());
+    }
+}
+
+
+/**
+ * Feed a FrozenBuilder_ from an xmlTextReader, consuming the reader.
+ */
+static void
+buildFromReader_(FrozenBuilder_ &b, xmlTextReader *readerPtr)
+{
+    std::unique_ptr<xmlTextReader, void (*)(xmlTextReader *)>
+        owner(readerPtr, ::xmlFreeTextReader);
+    xmlTextReader *reader = owner.get();
+
+    int ret;
+    while((ret = ::xmlTextReaderRead(reader)) == 1) {
+        switch(::xmlTextReaderNodeType(reader)) {
+            case XML_READER_TYPE_ELEMENT: {
+                bool empty = ::xmlTextReaderIsEmptyElement(reader) == 1;
+                b.start(view_(::xmlTextReaderConstNamespaceUri(reader)),
+                        view_(::xmlTextReaderConstLocalName(reader)));
+                while(::xmlTextReaderMoveToNextAttribute(reader) == 1) {
+                    if(! ::xmlTextReaderIsNamespaceDecl(reader)) {
+                        b.attr(view_(::xmlTextReaderConstNamespaceUri(reader)),
+                               view_(::xmlTextReaderConstLocalName(reader)),
+                               view_(::xmlTextReaderConstValue(reader)));
+                    }
+                }
+                if(empty) {
+                    b.end();
+                }
+                break;
+            }
+            case XML_READER_TYPE_END_ELEMENT:
+                b.end();
+                break;
+            case XML_READER_TYPE_TEXT:
+            case XML_READER_TYPE_CDATA:
+            case XML_READER_TYPE_WHITESPACE:
+            case XML_READER_TYPE_SIGNIFICANT_WHITESPACE:
+                b.text(view_(::xmlTextReaderConstValue(reader)));
+                break;
+            default:
+                b.interrupt();
+                break;
+        }
+    }
+
+    if(ret < 0) {
+        maybeThrow_();
+        throw parse_error();
+    }
+    b.finish();
+}
+
+
+static int
+istreamRead_(void *strm, char *buffer, int len)
+{
+    std::istream &is = *static_cast<std::istream *>(strm);
+
+    is.read(buffer, len);
+    if(is.fail() && !is.eof()) {
+        return -1;
+    }
+    return is.gcount();
+}
+
+
+static int
+dummyClose_(void *ignored)
+{
+    return 0;
+}
+
+
+// --------------------
+// FrozenTree functions
+// --------------------
+
+
+FrozenTree::FrozenTree()
+{
+}
+
+
+FrozenTree::FrozenTree(const Element &root)
+{
+    FrozenBuilder_ b(*this);
+    string buf;
+    buildFromElement_(b, root, buf);
+    b.finish();
+}
+
+
+FrozenTree::FrozenTree(const ElementTree &tree)
+    : FrozenTree(tree.getroot())
+{
+}
+
+
+FrozenTree
+FrozenTree::fromstring(const char *s, size_t n)
+{
+    if(n == 0) {
+        n = ::strlen(s);
+    }
+
+    ::xmlResetLastError();
+    xmlTextReader *reader = ::xmlReaderForMemory(s, n, NULL, NULL, 0);
+    if(! reader) {
+        throw memory_error();
+    }
+
+    FrozenTree tree;
+    FrozenBuilder_ b(tree);
+    buildFromReader_(b, reader);
+    return tree;
+}
+
+
+FrozenTree
+FrozenTree::parse(std::istream &is)
+{
+    ::xmlResetLastError();
+    xmlTextReader *reader = ::xmlReaderForIO(istreamRead_, dummyClose_,
+                                             static_cast<void *>(&is),
+                                             NULL, NULL, 0);
+    if(! reader) {
+        throw memory_error();
+    }
+
+    FrozenTree tree;
+    FrozenBuilder_ b(tree);
+    buildFromReader_(b, reader);
+    return tree;
+}
+
+
+std::string_view
+FrozenTree::str_(uint32_t id) const
+{
+    return std::string_view(pool_.data() + strings_[id],
+                            strings_[id + 1] - strings_[id]);
+}
+
+
+uint32_t
+FrozenTree::attrsEnd_(uint32_t index) const
+{
+    return (index + 1 < nodes_.size()) ? nodes_[index + 1].attrs
+                                       : attrs_.size();
+}
+
+
+uint32_t
+FrozenTree::findName_(std::string_view ns, std::string_view tag) const
+{
+    for(uint32_t i = 0; i < names_.size(); i++) {
+        if(str_(names_[i].tag) == tag && str_(names_[i].ns) == ns) {
+            return i;
+        }
+    }
+    return NONE;
+}
+
+
+FrozenElement
+FrozenTree::getroot() const
+{
+    return FrozenElement(this, 0);
+}
+
+
+size_t
+FrozenTree::size() const
+{
+    return nodes_.size();
+}
+
+
+size_t
+FrozenTree::memory_usage() const
+{
+    return (nodes_.capacity() * sizeof(Node_))
+         + (attrs_.capacity() * sizeof(Attr_))
+         + (names_.capacity() * sizeof(Name_))
+         + (strings_.capacity() * sizeof(uint32_t))
+         + pool_.capacity();
+}
+
+
+// ---------------------------
+// FrozenTree::Path_ functions
+// ---------------------------
+
+
+/**
+ * ElementPath evaluation over a FrozenTree, mirroring runPath_() in
+ * element.cpp. Name tests are resolved against the tree's name table once
+ * per evaluation, so matching an element is a single table lookup.
+ */
+struct FrozenTree::Path_
+{
+    const FrozenTree &tree;
+    const PathOps &ops;
+    /// For each instruction, whether each entry of names_ matches it.
+    std::vector<std::vector<bool>> matches;
+    std::vector<std::unordered_set<uint32_t>> parents;
+
+    Path_(const FrozenTree &tree, const PathOps &ops)
+        : tree(tree)
+        , ops(ops)
+        , matches(ops.size())
+        , parents(ops.size())
+    {
+        for(size_t pc = 0; pc < ops.size(); pc++) {
+            const ElementPathOp &op = ops[pc];
+            auto &match = matches[pc];
+            match.resize(tree.names_.size());
+            for(size_t i = 0; i < match.size(); i++) {
+                const Name_ &name = tree.names_[i];
+                match[i] = (op.anyTag || op.tag == tree.str_(name.tag))
+                        && (op.anyNs || op.ns == tree.str_(name.ns));
+            }
+        }
+    }
+
+    bool nameMatches(size_t pc, uint32_t node) const
+    {
+        return matches[pc][tree.nodes_[node].name];
+    }
+
+    /// Children of node are found by starting at node + 1 and skipping each
+    /// child's subtree, until reaching node's end.
+    uint32_t firstChild(uint32_t node) const
+    {
+        return (node + 1 < tree.nodes_[node].end) ? node + 1 : NONE;
+    }
+
+    uint32_t nextSibling(uint32_t node) const
+    {
+        uint32_t parent = tree.nodes_[node].parent;
+        uint32_t next = tree.nodes_[node].end;
+        return (parent != NONE && next < tree.nodes_[parent].end) ? next : NONE;
+    }
+
+    void textContent(uint32_t node, string &out) const
+    {
+        const Node_ &n = tree.nodes_[node];
+        out += tree.str_(n.text);
+        for(uint32_t cur = firstChild(node); cur != NONE;
+                cur = nextSibling(cur)) {
+            textContent(cur, out);
+            out += tree.str_(tree.nodes_[cur].tail);
+        }
+    }
+
+    bool textEquals(uint32_t node, const string &value) const
+    {
+        string s;
+        textContent(node, s);
+        return s == value;
+    }
+
+    bool predicateMatches(size_t pc, uint32_t node) const
+    {
+        const ElementPathOp &op = ops[pc];
+        switch(op.type) {
+            case ElementPathOp::HAS_ATTR:
+            case ElementPathOp::ATTR_EQUALS:
+                for(uint32_t i = tree.nodes_[node].attrs;
+                        i < tree.attrsEnd_(node); i++) {
+                    const Attr_ &attr = tree.attrs_[i];
+                    if(matches[pc][attr.name]) {
+                        return op.type == ElementPathOp::HAS_ATTR
+                            || op.value == tree.str_(attr.value);
+                    }
+                }
+                return false;
+            case ElementPathOp::HAS_CHILD:
+            case ElementPathOp::CHILD_TEXT_EQUALS:
+                for(uint32_t cur = firstChild(node); cur != NONE;
+                        cur = nextSibling(cur)) {
+                    if(nameMatches(pc, cur)
+                       && (op.type == ElementPathOp::HAS_CHILD
+                           || textEquals(cur, op.value))) {
+                        return true;
+                    }
+                }
+                return false;
+            case ElementPathOp::TEXT_EQUALS:
+                return textEquals(node, op.value);
+            case ElementPathOp::POSITION: {
+                uint32_t parent = tree.nodes_[node].parent;
+                if(parent == NONE) {
+                    return op.index == 1;
+                }
+                uint32_t name = tree.nodes_[node].name;
+                long pos = 1;
+                for(uint32_t cur = parent + 1; cur != node;
+                        cur = tree.nodes_[cur].end) {
+                    pos += tree.nodes_[cur].name == name;
+                }
+                return pos == op.index;
+            }
+            case ElementPathOp::LAST: {
+                uint32_t name = tree.nodes_[node].name;
+                long following = 0;
+                for(uint32_t cur = nextSibling(node); cur != NONE;
+                        cur = nextSibling(cur)) {
+                    following += tree.nodes_[cur].name == name;
+                }
+                return following == op.index;
+            }
+            default:
+                assert(0);
+                return false;
+        }
+    }
+
+    /**
+     * Run the remainder of the program from some instruction against a node,
+     * calling func(uint32_t) for each result until it returns false. Returns
+     * false if evaluation was stopped.
+     */
+    template<typename Function>
+    bool run(size_t pc, uint32_t node, Function &func)
+    {
+        if(pc == ops.size()) {
+            return func(node);
+        }
+
+        const ElementPathOp &op = ops[pc];
+        switch(op.type) {
+            case ElementPathOp::SELF:
+                return run(pc + 1, node, func);
+
+            case ElementPathOp::CHILD:
+                for(uint32_t cur = firstChild(node); cur != NONE;
+                        cur = nextSibling(cur)) {
+                    if(nameMatches(pc, cur) && !run(pc + 1, cur, func)) {
+                        return false;
+                    }
+                }
+                return true;
+
+            case ElementPathOp::DESCENDANT:
+                // Descendants are exactly the following elements up to end.
+                for(uint32_t cur = node + 1; cur < tree.nodes_[node].end;
+                        cur++) {
+                    if(nameMatches(pc, cur) && !run(pc + 1, cur, func)) {
+                        return false;
+                    }
+                }
+                return true;
+
+            case ElementPathOp::PARENT: {
+                uint32_t parent = tree.nodes_[node].parent;
+                if(parent != NONE && parents[pc].insert(parent).second) {
+                    return run(pc + 1, parent, func);
+                }
+                return true;
+            }
+
+            default:
+                if(predicateMatches(pc, node)) {
+                    return run(pc + 1, node, func);
+                }
+                return true;
+        }
+    }
+};
+
+
+// -----------------------
+// FrozenElement functions
+// -----------------------
+
+
+FrozenElement::FrozenElement(const FrozenTree *tree, uint32_t index)
+    : tree_(tree)
+    , index_(index)
+{
+}
+
+
+QName
+FrozenElement::qname() const
+{
+    return QName(string(ns()), string(tag()));
+}
+
+
+std::string_view
+FrozenElement::tag() const
+{
+    auto &node = tree_->nodes_[index_];
+    return tree_->str_(tree_->names_[node.name].tag);
+}
+
+
+std::string_view
+FrozenElement::ns() const
+{
+    auto &node = tree_->nodes_[index_];
+    return tree_->str_(tree_->names_[node.name].ns);
+}
+
+
+std::string_view
+FrozenElement::text() const
+{
+    return tree_->str_(tree_->nodes_[index_].text);
+}
+
+
+std::string_view
+FrozenElement::tail() const
+{
+    return tree_->str_(tree_->nodes_[index_].tail);
+}
+
+
+std::string_view
+FrozenElement::get(const QNameView &qn, std::string_view default_) const
+{
+    uint32_t name = tree_->findName_(qn.ns(), qn.tag());
+    if(name != FrozenTree::NONE) {
+        uint32_t end = tree_->attrsEnd_(index_);
+        for(uint32_t i = tree_->nodes_[index_].attrs; i < end; i++) {
+            if(tree_->attrs_[i].name == name) {
+                return tree_->str_(tree_->attrs_[i].value);
+            }
+        }
+    }
+    return default_;
+}
+
+
+std::string_view
+FrozenElement::get(const char *qname, std::string_view default_) const
+{
+    return get(QNameView(qname), default_);
+}
+
+
+std::vector<AttrItem>
+FrozenElement::attrib() const
+{
+    std::vector<AttrItem> out;
+    uint32_t end = tree_->attrsEnd_(index_);
+    for(uint32_t i = tree_->nodes_[index_].attrs; i < end; i++) {
+        auto &attr = tree_->attrs_[i];
+        auto &name = tree_->names_[attr.name];
+        out.push_back({tree_->str_(name.ns), tree_->str_(name.tag),
+                       tree_->str_(attr.value)});
+    }
+    return out;
+}
+
+
+size_t
+FrozenElement::size() const
+{
+    size_t n = 0;
+    for(uint32_t cur = index_ + 1; cur < tree_->nodes_[index_].end;
+            cur = tree_->nodes_[cur].end) {
+        n++;
+    }
+    return n;
+}
+
+
+FrozenElement
+FrozenElement::operator[](size_t i) const
+{
+    for(uint32_t cur = index_ + 1; cur < tree_->nodes_[index_].end;
+            cur = tree_->nodes_[cur].end) {
+        if(! i--) {
+            return FrozenElement(tree_, cur);
+        }
+    }
+    throw out_of_bounds_error();
+}
+
+
+std::vector<FrozenElement>
+FrozenElement::children() const
+{
+    std::vector<FrozenElement> out;
+    for(uint32_t cur = index_ + 1; cur < tree_->nodes_[index_].end;
+            cur = tree_->nodes_[cur].end) {
+        out.emplace_back(tree_, cur);
+    }
+    return out;
+}
+
+
+Nullable<FrozenElement>
+FrozenElement::child(const QNameView &qn) const
+{
+    uint32_t name = tree_->findName_(qn.ns(), qn.tag());
+    if(name != FrozenTree::NONE) {
+        for(uint32_t cur = index_ + 1; cur < tree_->nodes_[index_].end;
+                cur = tree_->nodes_[cur].end) {
+            if(tree_->nodes_[cur].name == name) {
+                return FrozenElement(tree_, cur);
+            }
+        }
+    }
+    return Nullable<FrozenElement>();
+}
+
+
+Nullable<FrozenElement>
+FrozenElement::child(const char *qname) const
+{
+    return child(QNameView(qname));
+}
+
+
+Nullable<FrozenElement>
+FrozenElement::getparent() const
+{
+    uint32_t parent = tree_->nodes_[index_].parent;
+    if(parent == FrozenTree::NONE) {
+        return Nullable<FrozenElement>();
+    }
+    return FrozenElement(tree_, parent);
+}
+
+
+Nullable<FrozenElement>
+FrozenElement::find(const ElementPath &path) const
+{
+    Nullable<FrozenElement> out;
+    FrozenTree::Path_ runner(*tree_, *path.ops_);
+    auto func = [&](uint32_t node) {
+        out = FrozenElement(tree_, node);
+        return false;
+    };
+    runner.run(0, index_, func);
+    return out;
+}
+
+
+std::vector<FrozenElement>
+FrozenElement::findall(const ElementPath &path) const
+{
+    std::vector<FrozenElement> out;
+    FrozenTree::Path_ runner(*tree_, *path.ops_);
+    auto func = [&](uint32_t node) {
+        out.emplace_back(tree_, node);
+        return true;
+    };
+    runner.run(0, index_, func);
+    return out;
+}
+
+
+std::string_view
+FrozenElement::findtext(const ElementPath &path,
+                        std::string_view default_) const
+{
+    auto maybe = find(path);
+    return maybe ? maybe->text() : default_;
+}
+
+
+bool
+FrozenElement::operator==(const FrozenElement &other) const
+{
+    return tree_ == other.tree_ && index_ == other.index_;
+}
+
+
+bool
+FrozenElement::operator!=(const FrozenElement &other) const
+{
+    return !(*this == other);
+}
+
+
+} // namespace
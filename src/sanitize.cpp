@@ -1,5 +1,5 @@
+#include <cstring>
 #include <iostream>
-#include <unordered_set>
 
 #include <elementtree/element.hpp>
 #include <elementtree/feed.hpp>
@@ -48,10 +48,10 @@ static const char attrWhitelist_[] = (
 );
 
 
-static std::unordered_set<etree::QName>
+static etree::QNameSet
 buildSet_(const char *array, size_t size)
 {
-    std::unordered_set<etree::QName> set;
+    etree::QNameSet set;
     for(auto s = array; s < (array + size); s += 1 + ::strlen(s)) {
         set.insert(s);
     }
@@ -70,6 +70,9 @@ int main()
     etree::visit(doc.getroot(), [&](etree::Element &e)
     {
         all.push_back(e);
+        // Removed along with the element, so no need to look inside.
+        return tagRemove.contains(NULL, e.tag().c_str())
+            ? etree::SKIP_CHILDREN : etree::CONTINUE;
     });
 
     while(all.size()) {
@@ -77,21 +80,18 @@ int main()
         all.pop_back();
 
         auto tag = e.tag();
-        if(tagRemove.count(tag)) {
+        if(tagRemove.contains(NULL, tag.c_str())) {
             e.remove();
             continue;
         }
 
-        if(! tagWhitelist.count(tag)) {
+        if(! tagWhitelist.contains(NULL, tag.c_str())) {
             e.graft();
         }
 
-        for(auto &attr : e.attrib()) {
-            auto tag = attr.tag();
-            if(! attrWhitelist.count(tag)) {
-                e.attrib().remove(tag);
-            }
-        }
+        e.attrib().retain_if([&](const etree::AttrItem &attr) {
+            return attrWhitelist.contains(std::string_view(), attr.tag);
+        });
     }
 
     std::cout << etree::tostring(doc.getroot());
@@ -168,3 +168,121 @@ TEST_CASE("iterSurvivesMutation", "[attrib]")
     REQUIRE(got == expect);
     REQUIRE(etree::tostring(root) == "<a b=\"2\" c=\"3\"/>");
 }
+
+
+TEST_CASE("HasNsTag", "[attrib]")
+{
+    auto root = etree::fromstring(DOC);
+    REQUIRE(root.attrib().has("urn:ns", "x"));
+    REQUIRE(root.attrib().has("", "type"));
+    REQUIRE_FALSE(root.attrib().has("", "x"));
+    REQUIRE_FALSE(root.attrib().has("urn:ns", "type"));
+}
+
+
+TEST_CASE("GetQNameView", "[attrib]")
+{
+    static constexpr etree::QNameView kX("{urn:ns}x");
+    auto root = etree::fromstring(DOC);
+    REQUIRE("true" == root.attrib().get(kX));
+    REQUIRE("true" == root.get(kX));
+    REQUIRE("d" == root.attrib().get(etree::QNameView("{urn:ns}y"), "d"));
+}
+
+
+TEST_CASE("GetEntityValue", "[attrib]")
+{
+    auto root = etree::fromstring(
+        "<!DOCTYPE r [<!ENTITY e \"x\">]>"
+        "<r a=\"1&e;2\"/>");
+    REQUIRE("1x2" == root.attrib().get("a"));
+}
+
+
+TEST_CASE("GetDtdDefault", "[attrib]")
+{
+    auto root = etree::fromstring(
+        "<!DOCTYPE r [<!ATTLIST r d CDATA \"dv\">]>"
+        "<r/>");
+    REQUIRE(root.attrib().has("d"));
+    REQUIRE("dv" == root.attrib().get("d"));
+    REQUIRE("dv" == root.attrib().get(etree::QName("d")));
+}
+
+
+TEST_CASE("GetView", "[attrib]")
+{
+    auto root = etree::fromstring(DOC);
+    string buf;
+    REQUIRE(root.attrib().get_view("type", buf) == "people");
+    REQUIRE(root.attrib().get_view("{urn:ns}x", buf) == "true");
+    REQUIRE(root.attrib().get_view("missing", buf).empty());
+    REQUIRE(buf.empty());
+}
+
+
+TEST_CASE("GetViewEntityValue", "[attrib]")
+{
+    auto root = etree::fromstring(
+        "<!DOCTYPE r [<!ENTITY e \"x\">]>"
+        "<r a=\"1&e;2\"/>");
+    string buf;
+    auto view = root.attrib().get_view("a", buf);
+    REQUIRE(view == "1x2");
+    REQUIRE(view.data() == buf.data());
+}
+
+
+TEST_CASE("ValueView", "[attrib]")
+{
+    auto root = etree::fromstring(DOC);
+    string buf;
+    for(auto attr : root.attrib()) {
+        REQUIRE(attr.value_view(buf) == attr.value());
+    }
+    REQUIRE(buf.empty());
+}
+
+
+TEST_CASE("Items", "[attrib]")
+{
+    auto root = etree::fromstring(
+        "<!DOCTYPE r [<!ENTITY e \"x\">]>"
+        "<r xmlns:ns=\"urn:ns\" a=\"1\" b=\"&e;&e;\" ns:c=\"3\" d=\"4&e;\"/>");
+    string buf;
+    auto items = root.attrib().items(buf);
+    REQUIRE(items.size() == 4);
+    REQUIRE(items[0].ns == "");
+    REQUIRE(items[0].tag == "a");
+    REQUIRE(items[0].value == "1");
+    REQUIRE(items[1].tag == "b");
+    REQUIRE(items[1].value == "xx");
+    REQUIRE(items[2].ns == "urn:ns");
+    REQUIRE(items[2].tag == "c");
+    REQUIRE(items[2].value == "3");
+    REQUIRE(items[3].tag == "d");
+    REQUIRE(items[3].value == "4x");
+}
+
+
+TEST_CASE("ItemsEmpty", "[attrib]")
+{
+    auto root = etree::fromstring("<r/>");
+    string buf;
+    REQUIRE(root.attrib().items(buf).empty());
+}
+
+
+TEST_CASE("RetainIf", "[attrib]")
+{
+    auto root = etree::fromstring(
+        "<r xmlns:ns=\"urn:ns\" a=\"1\" b=\"2\" ns:c=\"3\" d=\"4\"/>");
+    vector<string> seen;
+    auto removed = root.attrib().retain_if([&](const etree::AttrItem &item) {
+        seen.push_back(string(item.tag));
+        return item.tag != "b" && item.ns.empty();
+    });
+    REQUIRE(removed == 2);
+    REQUIRE(seen == vector<string>({"a", "b", "c", "d"}));
+    REQUIRE(root.attrib().keys() == vector<etree::QName>({"a", "d"}));
+}
@@ -1,4 +1,7 @@
 
+#include <atomic>
+#include <functional>
+#include <thread>
 #include <utility>
 #include <vector>
 
@@ -117,6 +120,49 @@ TEST_CASE("elemChildIter", "[element]")
 }
 
 
+//
+// iter()
+//
+
+
+static std::string
+iterTags_(const etree::ElementRange &range)
+{
+    std::string out;
+    for(auto e : range) {
+        out += e.tag();
+    }
+    return out;
+}
+
+
+TEST_CASE("elemIter", "[element]")
+{
+    auto root = etree::fromstring(
+        "<a xmlns:x=\"urn:x\"><b><c/>t<x:c/></b><!-- c --><c><d/></c></a>");
+    REQUIRE(iterTags_(root.iter()) == "abcccd");
+    REQUIRE(iterTags_(root.iter("c")) == "cc");
+    REQUIRE(iterTags_(root.iter("{urn:x}c")) == "c");
+    REQUIRE(iterTags_(root.iter("a")) == "a");
+    REQUIRE(iterTags_(root.iter("missing")) == "");
+    REQUIRE(iterTags_(root.child("b")->iter()) == "bcc");
+    REQUIRE(iterTags_(root.find("c/d")->iter()) == "d");
+}
+
+
+TEST_CASE("elemIterMatchesFindall", "[element]")
+{
+    auto root = etree::parse("testdata/pypy.atom.xml").getroot();
+    etree::QName qn("http://www.w3.org/2005/Atom", "link");
+    std::vector<Element> got;
+    for(auto e : root.iter(qn)) {
+        got.push_back(e);
+    }
+    REQUIRE(got.size() > 0);
+    REQUIRE(got == root.findall(".//{http://www.w3.org/2005/Atom}link"));
+}
+
+
 //
 // visit()
 //
@@ -139,6 +185,148 @@ TEST_CASE("visit", "[element]")
 }
 
 
+static std::string
+visitTags_(Element root, std::function<etree::visit_action(Element &)> fn)
+{
+    std::string out;
+    visit(root, [&](Element &e) {
+        out += e.tag();
+        return fn(e);
+    });
+    return out;
+}
+
+
+TEST_CASE("visitSkipChildren", "[element]")
+{
+    auto root = etree::fromstring("<a><b><c/><d/></b>x<e><f/></e></a>");
+    REQUIRE("abef" == visitTags_(root, [](Element &e) {
+        return e.tag() == "b" ? etree::SKIP_CHILDREN : etree::CONTINUE;
+    }));
+    REQUIRE("a" == visitTags_(root, [](Element &e) {
+        return etree::SKIP_CHILDREN;
+    }));
+}
+
+
+TEST_CASE("visitStop", "[element]")
+{
+    auto root = etree::fromstring("<a><b><c/><d/></b><e/></a>");
+    int count = 0;
+    REQUIRE(! visit(root, [&](Element &e) {
+        count++;
+        return e.tag() == "c" ? etree::STOP : etree::CONTINUE;
+    }));
+    REQUIRE(count == 3);
+    REQUIRE(visit(root, [&](Element &e) {}));
+}
+
+
+TEST_CASE("visitSubtree", "[element]")
+{
+    auto root = etree::fromstring("<a><b><c/></b><d/></a>");
+    REQUIRE("bc" == visitTags_(*root.child("b"), [](Element &e) {
+        return etree::CONTINUE;
+    }));
+}
+
+
+TEST_CASE("visitRemoveAndGraft", "[element]")
+{
+    auto root = etree::fromstring("<a><b><c/></b><d><e/></d><f/></a>");
+    REQUIRE("abdef" == visitTags_(root, [](Element &e) {
+        if(e.tag() == "b") {
+            e.remove();
+        } else if(e.tag() == "d") {
+            e.graft();
+        }
+        return etree::CONTINUE;
+    }));
+    REQUIRE(etree::tostring(root) == "<a><e/><f/></a>");
+}
+
+
+TEST_CASE("visitDeep", "[element]")
+{
+    auto root = etree::fromstring("<a/>");
+    auto cur = root;
+    for(int i = 0; i < 200000; i++) {
+        cur = etree::SubElement(cur, "a");
+    }
+
+    size_t count = 0;
+    visit(root, [&](Element &e) {
+        count++;
+    });
+    REQUIRE(count == 200001);
+}
+
+
+static Element
+wideTree_(int width, int depth)
+{
+    auto root = etree::fromstring("<r/>");
+    std::vector<Element> level {root};
+    for(int d = 0; d < depth; d++) {
+        std::vector<Element> next;
+        for(auto &parent : level) {
+            for(int i = 0; i < width; i++) {
+                next.push_back(etree::SubElement(parent,
+                    (i % 3) ? "a" : "b"));
+            }
+        }
+        level.swap(next);
+    }
+    return root;
+}
+
+
+TEST_CASE("parallelVisit", "[element]")
+{
+    auto root = wideTree_(6, 4);
+    std::atomic<size_t> count(0);
+    REQUIRE(etree::parallel_visit(root, [&](Element &e) {
+        count++;
+    }, 4));
+    REQUIRE(count == 1 + 6 + 36 + 216 + 1296);
+
+    // Pruning every <b> leaves only <a> chains below the root.
+    count = 0;
+    etree::parallel_visit(root, [&](Element &e) {
+        count++;
+        return e.tag() == "b" ? etree::SKIP_CHILDREN : etree::CONTINUE;
+    }, 4);
+    REQUIRE(count == 1 + 6 + 4 * 6 + 16 * 6 + 64 * 6);
+}
+
+
+TEST_CASE("parallelVisitStopAndThrow", "[element]")
+{
+    auto root = wideTree_(6, 4);
+    REQUIRE(! etree::parallel_visit(root, [&](Element &e) {
+        return etree::STOP;
+    }, 4));
+    REQUIRE_THROWS_AS(etree::parallel_visit(root, [&](Element &e) {
+        if(e.tag() == "b") {
+            throw etree::internal_error();
+        }
+    }, 4), etree::internal_error);
+}
+
+
+TEST_CASE("parallelFindall", "[element]")
+{
+    auto root = wideTree_(6, 4);
+    auto expect = root.findall(".//b");
+    for(unsigned threads : {1, 3, 8}) {
+        auto got = etree::parallel_findall(root, [](const Element &e) {
+            return e.tag() == "b";
+        }, threads);
+        REQUIRE(got == expect);
+    }
+}
+
+
 // ----------
 // ancestorOf
 // ----------
@@ -235,6 +423,41 @@ TEST_CASE("elemAppendMoveNsSimple2", "[element]")
 }
 
 
+TEST_CASE("elemAppendMoveNsNew", "[element]")
+{
+    auto root = etree::fromstring("<a/>");
+    auto root2 = etree::fromstring(
+        "<b xmlns=\"urn:x\" xmlns:y=\"urn:y\"><c y:k=\"1\"/></b>");
+    root.append(root2);
+    REQUIRE(etree::tostring(root) ==
+        "<a><b xmlns=\"urn:x\" xmlns:y=\"urn:y\"><c y:k=\"1\"/></b></a>");
+}
+
+
+TEST_CASE("elemAppendMoveNsShadowed", "[element]")
+{
+    auto root = etree::fromstring(
+        "<a xmlns:p=\"urn:outer\"><b xmlns:p=\"urn:inner\"/></a>");
+    auto root2 = etree::fromstring("<x xmlns=\"urn:outer\"/>");
+    root[0].append(root2);
+    REQUIRE(etree::tostring(root) ==
+        "<a xmlns:p=\"urn:outer\"><b xmlns:p=\"urn:inner\">"
+            "<x xmlns=\"urn:outer\"/>"
+        "</b></a>");
+}
+
+
+TEST_CASE("elemAppendMoveSameDoc", "[element]")
+{
+    auto root = etree::fromstring(
+        "<a xmlns:p=\"urn:p\"><b><p:c p:k=\"1\"/></b><d/></a>");
+    auto c = root[0][0];
+    root[1].append(c);
+    REQUIRE(etree::tostring(root) ==
+        "<a xmlns:p=\"urn:p\"><b/><d><p:c p:k=\"1\"/></d></a>");
+}
+
+
 TEST_CASE("elemAppendMoveNsNested", "[element]")
 {
     auto root = etree::fromstring(DOC);
@@ -278,6 +501,66 @@ TEST_CASE("childAbsent", "[element]")
 }
 
 
+TEST_CASE("childAtom", "[element]")
+{
+    static const etree::Atom kChild("urn:foo", "child");
+    auto root = etree::fromstring(
+        "<root>"
+        "<child>a</child>"
+        "<child xmlns=\"urn:foo\">b</child>"
+        "</root>");
+    auto child = root.child(kChild);
+    REQUIRE(child);
+    REQUIRE(child->text() == "b");
+}
+
+
+TEST_CASE("childQNameView", "[element]")
+{
+    static constexpr etree::QNameView kChild("{urn:foo}child");
+    auto root = etree::fromstring(
+        "<root>"
+        "<child>a</child>"
+        "<child xmlns=\"urn:foo\">b</child>"
+        "</root>");
+    REQUIRE(root.child(kChild)->text() == "b");
+    REQUIRE(root.children(kChild).size() == 1);
+    REQUIRE(root.ensurechild(kChild).text() == "b");
+    REQUIRE(root.ensurechild(etree::QNameView("{urn:bar}x")).qname() ==
+            etree::QName("urn:bar", "x"));
+}
+
+
+TEST_CASE("childNsTag", "[element]")
+{
+    auto root = etree::fromstring(
+        "<root>"
+        "<child>a</child>"
+        "<child xmlns=\"urn:foo\">b</child>"
+        "</root>");
+    REQUIRE(root.child("urn:foo", "child")->text() == "b");
+    REQUIRE(root.child("", "child")->text() == "a");
+    REQUIRE(root.children("urn:foo", "child").size() == 1);
+    REQUIRE_FALSE(root.child("urn:bar", "child"));
+    REQUIRE(root.ensurechild("urn:bar", "child").ns() == "urn:bar");
+    REQUIRE(root.children("child").size() == 1);
+}
+
+
+TEST_CASE("childrenMixedNs", "[element]")
+{
+    auto root = etree::fromstring(
+        "<root xmlns:a=\"urn:a\" xmlns:b=\"urn:b\">"
+        "<a:x>1</a:x><b:x>2</b:x><a:x>3</a:x><x>4</x><a:y>5</a:y>"
+        "</root>");
+    auto children = root.children("{urn:a}x");
+    REQUIRE(children.size() == 2);
+    REQUIRE(children[0].text() == "1");
+    REQUIRE(children[1].text() == "3");
+    REQUIRE(root.children("x").size() == 1);
+}
+
+
 //
 // Element::ensurechild()
 //
@@ -421,6 +704,172 @@ TEST_CASE("elemGetroottreeRemoved", "[element]")
 }
 
 
+TEST_CASE("treeCopy", "[element]")
+{
+    auto root = etree::fromstring("<root/>");
+    auto tree = root.getroottree();
+    {
+        auto tree2 = tree;
+        REQUIRE(tree2 == tree);
+    }
+    REQUIRE(etree::tostring(tree.getroot()) == "<root/>");
+}
+
+
+TEST_CASE("treeSnapshot", "[element]")
+{
+    auto root = etree::fromstring("<root><a>1</a></root>");
+    auto snap = root.getroottree().snapshot();
+    root.child("a")->text("2");
+    REQUIRE(*snap != root.getroottree());
+    REQUIRE(snap->getroot().findtext("a") == "1");
+    REQUIRE(root.findtext("a") == "2");
+}
+
+
+TEST_CASE("treeSnapshotConcurrentReaders", "[element]")
+{
+    auto root = etree::fromstring("<root><a>1</a><a>2</a><a>3</a></root>");
+    auto current = root.getroottree().snapshot();
+    std::atomic<int> bad(0);
+
+    std::vector<std::thread> readers;
+    for(int i = 0; i < 4; i++) {
+        readers.emplace_back([&]() {
+            for(int j = 0; j < 2000; j++) {
+                auto snap = std::atomic_load(&current);
+                if(snap->getroot().findall("a").size() != 3) {
+                    bad++;
+                }
+            }
+        });
+    }
+    for(int i = 0; i < 50; i++) {
+        root.child("a")->text(std::to_string(i));
+        std::atomic_store(&current, root.getroottree().snapshot());
+    }
+    for(auto &t : readers) {
+        t.join();
+    }
+    REQUIRE(bad == 0);
+}
+
+
+static auto INDEX_DOC = (
+    "<feed xmlns=\"urn:a\">"
+        "<entry><id>1</id><link rel=\"self\" href=\"x\"/></entry>"
+        "<entry><id>2</id><link href=\"y\"/><link href=\"z\"/></entry>"
+        "<group xmlns=\"\"><entry guid=\"g\"/></group>"
+    "</feed>"
+);
+
+
+TEST_CASE("treeIndexFind", "[element]")
+{
+    auto tree = etree::fromstring(INDEX_DOC).getroottree();
+    etree::QName entry("urn:a", "entry"), link("urn:a", "link");
+    for(int pass = 0; pass < 2; pass++) {
+        REQUIRE(tree.indexed() == (pass == 1));
+        REQUIRE(tree.findall(entry).size() == 2);
+        REQUIRE(tree.findall(link).size() == 3);
+        REQUIRE(tree.findall("entry").size() == 1);
+        REQUIRE(tree.findall("{urn:a}feed").size() == 1);
+        REQUIRE(tree.findall("missing").empty());
+        REQUIRE(tree.find(link)->get("href") == "x");
+        REQUIRE(! tree.find("missing"));
+        REQUIRE(tree.find_by_attr("href", "z")->get("href") == "z");
+        REQUIRE(tree.find_by_attr("guid", "g")->tag() == "entry");
+        REQUIRE(! tree.find_by_attr("href", "q"));
+        REQUIRE(tree.findall(link) ==
+                tree.getroot().findall(".//{urn:a}link"));
+        tree.build_index({"href", "guid"});
+    }
+}
+
+
+TEST_CASE("treeIndexDiscardedOnMutation", "[element]")
+{
+    auto tree = etree::fromstring(INDEX_DOC).getroottree();
+    auto root = tree.getroot();
+    etree::QName entry("urn:a", "entry");
+    std::vector<std::function<void()>> mutations {
+        [&]() { etree::SubElement(root, entry); },
+        [&]() { root.child(entry)->remove(); },
+        [&]() { root.child(entry)->tag("other"); },
+        [&]() { root.child(entry)->attrib().set("k", "v"); },
+        [&]() { root.child(entry)->copy_into(root); },
+        [&]() { root.child("group")->graft(); },
+    };
+
+    for(auto &mutate : mutations) {
+        tree.build_index({"guid"});
+        REQUIRE(tree.indexed());
+        root.child(entry)->text("text keeps the index");
+        REQUIRE(tree.indexed());
+        mutate();
+        REQUIRE(! tree.indexed());
+        std::vector<Element> expect;
+        for(auto e : root.iter(entry)) {
+            expect.push_back(e);
+        }
+        REQUIRE(tree.findall(entry) == expect);
+    }
+}
+
+
+TEST_CASE("treeIndexMoveBetweenDocuments", "[element]")
+{
+    auto a = etree::fromstring("<a><x/></a>").getroottree();
+    auto b = etree::fromstring("<b/>").getroottree();
+    a.build_index();
+    b.build_index();
+    b.getroot().append(*a.getroot().child("x"));
+    REQUIRE(! a.indexed());
+    REQUIRE(! b.indexed());
+    REQUIRE(a.findall("x").empty());
+    REQUIRE(b.findall("x").size() == 1);
+}
+
+
+// ------
+// extend
+// ------
+
+
+TEST_CASE("elemExtend", "[element]")
+{
+    auto root = etree::fromstring("<a xmlns=\"urn:a\"/>");
+    auto src1 = etree::fromstring("<f xmlns=\"urn:a\"><b/><c/></f>");
+    auto src2 = etree::fromstring("<f xmlns:y=\"urn:y\"><y:d/></f>");
+    root.extend(src1.children());
+    root.extend(src2.children());
+    REQUIRE(etree::tostring(root) ==
+        "<a xmlns=\"urn:a\"><b/><c/><ns0:d xmlns:ns0=\"urn:y\"/></a>");
+    REQUIRE(etree::tostring(src1) == "<f xmlns=\"urn:a\"/>");
+}
+
+
+TEST_CASE("elemExtendRange", "[element]")
+{
+    auto root = etree::fromstring("<a/>");
+    auto src = etree::fromstring("<f><b/>x<c/>y<d/></f>");
+    auto children = src.children();
+    root.extend(children.begin() + 1, children.end());
+    REQUIRE(etree::tostring(root) == "<a><c/>y<d/></a>");
+    REQUIRE(etree::tostring(src) == "<f><b/>x</f>");
+}
+
+
+TEST_CASE("elemExtendAncestorFails", "[element]")
+{
+    auto root = etree::fromstring("<a><b/></a>");
+    auto other = etree::fromstring("<c/>");
+    auto b = root[0];
+    REQUIRE_THROWS_AS(b.extend({other, root}), etree::cyclical_tree_error);
+    REQUIRE(etree::tostring(b) == "<b/>");
+}
+
+
 // ------
 // insert
 // -----
@@ -666,6 +1115,60 @@ TEST_CASE("elemTextSetChildElements", "[element]")
 }
 
 
+TEST_CASE("elemTextView", "[element]")
+{
+    auto elem = etree::fromstring("<name>David<lang/>en</name>");
+    std::string buf;
+    REQUIRE(elem.text_view(buf) == "David");
+    REQUIRE(elem.child("lang")->tail_view(buf) == "en");
+    REQUIRE(elem.tail_view(buf).empty());
+    REQUIRE(buf.empty());
+}
+
+
+TEST_CASE("elemTextViewMultiNode", "[element]")
+{
+    auto elem = etree::fromstring("<name>Da<![CDATA[v]]>id<lang/></name>");
+    std::string buf;
+    auto view = elem.text_view(buf);
+    REQUIRE(view == "David");
+    REQUIRE(view.data() == buf.data());
+    REQUIRE(elem.text() == "David");
+}
+
+
+TEST_CASE("elemItertext", "[element]")
+{
+    auto root = etree::fromstring(
+        "<r><a>1<b>2<c>3</c>4</b>5<!--x-->6<![CDATA[7]]></a>8</r>");
+    auto a = *root.child("a");
+    std::vector<std::string> got;
+    for(auto chunk : a.itertext()) {
+        got.push_back(std::string(chunk));
+    }
+    REQUIRE(got == std::vector<std::string>({
+        "1", "2", "3", "4", "5", "6", "7"
+    }));
+}
+
+
+TEST_CASE("elemItertextEmpty", "[element]")
+{
+    auto root = etree::fromstring("<r><a/>tail</r>");
+    auto range = root.child("a")->itertext();
+    REQUIRE(range.begin() == range.end());
+}
+
+
+TEST_CASE("elemTextcontent", "[element]")
+{
+    auto root = etree::fromstring("<r>x<b>y</b>z</r>");
+    std::string out("prefix:");
+    root.textcontent(out);
+    REQUIRE(out == "prefix:xyz");
+}
+
+
 //
 // tostring
 //
@@ -767,6 +1270,29 @@ TEST_CASE("copyNs", "[element]")
 }
 
 
+TEST_CASE("copyInto", "[element]")
+{
+    auto root = etree::fromstring("<feed xmlns=\"urn:a\"><x/></feed>");
+    auto src = etree::fromstring(
+        "<feed xmlns=\"urn:a\" xmlns:m=\"urn:m\"><e m:k=\"1\"/></feed>");
+    auto e = root.child("{urn:a}x")->copy_before(*root.child("{urn:a}x"));
+    src[0].copy_into(root);
+    REQUIRE(e.getroottree() == root.getroottree());
+    REQUIRE(etree::tostring(root) ==
+        "<feed xmlns=\"urn:a\"><x/><x/>"
+            "<e xmlns:m=\"urn:m\" m:k=\"1\"/>"
+        "</feed>");
+    REQUIRE(etree::tostring(src[0]) == "<e m:k=\"1\"/>");
+}
+
+
+TEST_CASE("copyBeforeRootFails", "[element]")
+{
+    auto root = etree::fromstring("<a><b/></a>");
+    REQUIRE_THROWS_AS(root[0].copy_before(root), etree::out_of_bounds_error);
+}
+
+
 //
 // Element::findall()
 //
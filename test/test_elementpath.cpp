@@ -0,0 +1,125 @@
+/*
+ * Copyright David Wilson, 2016.
+ * License: http://opensource.org/licenses/MIT
+ */
+
+#include <utility>
+#include <vector>
+
+#include <elementtree.hpp>
+
+#include "catch.hpp"
+
+
+using etree::Element;
+using etree::ElementPath;
+
+
+static auto PATH_DOC = (
+    "<root xmlns:a=\"urn:a\">"
+        "<item id=\"1\"><title>One</title></item>"
+        "<item id=\"2\"><title>Two</title><a:title>A</a:title></item>"
+        "<a:entry><a:title>Three</a:title></a:entry>"
+        "<group><item id=\"3\"><title>Four</title></item></group>"
+    "</root>"
+);
+
+
+TEST_CASE("pathChild", "[elementpath]")
+{
+    auto root = etree::fromstring(PATH_DOC);
+    REQUIRE(root.findall(ElementPath("item")).size() == 2);
+    REQUIRE(root.findtext(ElementPath("item/title")) == "One");
+    REQUIRE(ElementPath("item/title").findall(root).size() == 2);
+}
+
+
+TEST_CASE("pathUniversalName", "[elementpath]")
+{
+    auto root = etree::fromstring(PATH_DOC);
+    ElementPath path("{urn:a}entry/{urn:a}title");
+    REQUIRE(path.findtext(root) == "Three");
+    REQUIRE(root.findall(ElementPath("item/{urn:a}title")).size() == 1);
+    REQUIRE(root.findall(ElementPath(".//{*}title")).size() == 5);
+    REQUIRE(root.findall(ElementPath(".//{}title")).size() == 3);
+    REQUIRE(root.findall(ElementPath("{urn:a}*")).size() == 1);
+}
+
+
+TEST_CASE("pathPrefixes", "[elementpath]")
+{
+    auto root = etree::fromstring(PATH_DOC);
+    ElementPath path("x:entry/x:title", etree::ns_list{{"x", "urn:a"}});
+    REQUIRE(path.findtext(root) == "Three");
+
+    ElementPath dflt("entry/title", etree::ns_list{{"", "urn:a"}});
+    REQUIRE(dflt.findtext(root) == "Three");
+}
+
+
+TEST_CASE("pathDescendant", "[elementpath]")
+{
+    auto root = etree::fromstring(PATH_DOC);
+    auto items = root.findall(ElementPath(".//item"));
+    REQUIRE(items.size() == 3);
+    REQUIRE(items[2].get("id") == "3");
+    REQUIRE(root.findall(ElementPath("group//title")).size() == 1);
+    REQUIRE(root.findall(ElementPath(".//*")).size() == 10);
+}
+
+
+TEST_CASE("pathSelfParent", "[elementpath]")
+{
+    auto root = etree::fromstring(PATH_DOC);
+    REQUIRE(*root.find(ElementPath(".")) == root);
+    auto parents = root.findall(ElementPath("item/title/.."));
+    REQUIRE(parents == root.findall(ElementPath("item")));
+    REQUIRE(root.findall(ElementPath(".//title/../..")).size() == 2);
+}
+
+
+TEST_CASE("pathPredicates", "[elementpath]")
+{
+    auto root = etree::fromstring(PATH_DOC);
+    REQUIRE(root.findall(ElementPath("item[@id]")).size() == 2);
+    REQUIRE(root.findtext(ElementPath("item[@id='2']/title")) == "Two");
+    REQUIRE(root.findall(ElementPath("item[{urn:a}title]")).size() == 1);
+    REQUIRE(root.findall(ElementPath("item[title='One']")).size() == 1);
+    REQUIRE(root.findall(ElementPath("item/title[.='Two']")).size() == 1);
+    REQUIRE(root.findtext(ElementPath("item[1]/title")) == "One");
+    REQUIRE(root.findtext(ElementPath("item[2]/title")) == "Two");
+    REQUIRE_FALSE(root.find(ElementPath("item[3]")));
+    REQUIRE(root.findtext(ElementPath("item[last()]/title")) == "Two");
+    REQUIRE(root.findtext(ElementPath("item[last()-1]/title")) == "One");
+}
+
+
+TEST_CASE("pathFindtextDefault", "[elementpath]")
+{
+    auto root = etree::fromstring(PATH_DOC);
+    REQUIRE(root.findtext(ElementPath("missing"), "x") == "x");
+    REQUIRE(root.findtext(ElementPath("group"), "x") == "");
+}
+
+
+TEST_CASE("pathInvalid", "[elementpath]")
+{
+    REQUIRE_THROWS_AS(ElementPath(""), etree::invalid_path_error);
+    REQUIRE_THROWS_AS(ElementPath("/root"), etree::invalid_path_error);
+    REQUIRE_THROWS_AS(ElementPath("item/"), etree::invalid_path_error);
+    REQUIRE_THROWS_AS(ElementPath("item[@id"), etree::invalid_path_error);
+    REQUIRE_THROWS_AS(ElementPath("a:item"), etree::invalid_path_error);
+    REQUIRE_THROWS_AS(ElementPath("item[0]"), etree::invalid_path_error);
+    REQUIRE_THROWS_AS(ElementPath("a | b"), etree::invalid_path_error);
+}
+
+
+TEST_CASE("pathStringFallback", "[elementpath]")
+{
+    auto root = etree::fromstring(PATH_DOC);
+    REQUIRE(root.findall("item").size() == 2);
+    REQUIRE(root.findall(std::string(".//{urn:a}title")).size() == 2);
+    REQUIRE(root.findall("item | group").size() == 3);
+    REQUIRE(root.findtext("item[@id=2]/title") == "Two");
+    REQUIRE(root.find("count(item)") == etree::Nullable<Element>());
+}
@@ -0,0 +1,141 @@
+/*
+ * Copyright David Wilson, 2016.
+ * License: http://opensource.org/licenses/MIT
+ */
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <elementtree.hpp>
+
+#include "catch.hpp"
+
+
+using etree::FrozenElement;
+using etree::FrozenTree;
+
+
+static auto FROZEN_DOC = (
+    "<root xmlns:a=\"urn:a\">"
+        "head"
+        "<item id=\"1\"><title>One</title></item>tail1"
+        "<item id=\"2\" a:x=\"y\"><title>Two</title><a:title>A</a:title></item>"
+        "<!-- c -->"
+        "<a:entry><a:title>Three</a:title></a:entry>"
+        "<group><item id=\"3\"><title>Fo<![CDATA[ur]]></title></item></group>"
+    "</root>"
+);
+
+
+static std::vector<std::string>
+titles_(const std::vector<FrozenElement> &elems)
+{
+    std::vector<std::string> out;
+    for(auto &e : elems) {
+        out.emplace_back(e.findtext("title"));
+    }
+    return out;
+}
+
+
+TEST_CASE("frozenFromTreeMatchesParse", "[frozen]")
+{
+    auto root = etree::fromstring(FROZEN_DOC);
+    FrozenTree a(root.getroottree());
+    FrozenTree b = FrozenTree::fromstring(FROZEN_DOC);
+    std::istringstream is(FROZEN_DOC);
+    FrozenTree c = FrozenTree::parse(is);
+
+    for(auto *tree : {&a, &b, &c}) {
+        auto r = tree->getroot();
+        REQUIRE(tree->size() == 11);
+        REQUIRE(r.tag() == "root");
+        REQUIRE(r.text() == "head");
+        REQUIRE(r.size() == 4);
+        REQUIRE(r[0].tail() == "tail1");
+        REQUIRE(r[1].tail() == "");
+        REQUIRE(r[1].get("id") == "2");
+        REQUIRE(r[1].get("{urn:a}x") == "y");
+        REQUIRE(r[1].get("missing", "d") == "d");
+        REQUIRE(r[2].qname() == etree::QName("urn:a", "entry"));
+        REQUIRE(r[3][0][0].text() == "Four");
+        REQUIRE(*r[3][0].getparent() == r[3]);
+        REQUIRE(! r.getparent());
+        REQUIRE_THROWS_AS(r[4], etree::out_of_bounds_error);
+    }
+}
+
+
+TEST_CASE("frozenAttrib", "[frozen]")
+{
+    auto tree = FrozenTree::fromstring(FROZEN_DOC);
+    auto attrs = tree.getroot()[1].attrib();
+    REQUIRE(attrs.size() == 2);
+    REQUIRE(attrs[0].tag == "id");
+    REQUIRE(attrs[0].value == "2");
+    REQUIRE(attrs[1].ns == "urn:a");
+    REQUIRE(attrs[1].tag == "x");
+}
+
+
+TEST_CASE("frozenChild", "[frozen]")
+{
+    auto tree = FrozenTree::fromstring(FROZEN_DOC);
+    auto root = tree.getroot();
+    REQUIRE(root.child("item")->get("id") == "1");
+    REQUIRE(root.child("{urn:a}entry"));
+    REQUIRE(! root.child("missing"));
+    REQUIRE(root.children().size() == 4);
+}
+
+
+TEST_CASE("frozenFindall", "[frozen]")
+{
+    auto tree = FrozenTree::fromstring(FROZEN_DOC);
+    auto root = tree.getroot();
+    REQUIRE(titles_(root.findall("item")) ==
+        (std::vector<std::string> {"One", "Two"}));
+    REQUIRE(titles_(root.findall(".//item")) ==
+        (std::vector<std::string> {"One", "Two", "Four"}));
+    REQUIRE(titles_(root.findall("item[@id='2']")) ==
+        (std::vector<std::string> {"Two"}));
+    REQUIRE(titles_(root.findall("item[last()]")) ==
+        (std::vector<std::string> {"Two"}));
+    REQUIRE(titles_(root.findall(".//item[title='Four']")) ==
+        (std::vector<std::string> {"Four"}));
+    REQUIRE(root.findall(".//{urn:a}title").size() == 2);
+    REQUIRE(root.findall("item/..").size() == 1);
+    REQUIRE(root.findtext("{*}entry/{*}title") == "Three");
+    REQUIRE(root.findtext("nothing", "x") == "x");
+}
+
+
+TEST_CASE("frozenMatchesElementPath", "[frozen]")
+{
+    auto root = etree::fromstring(FROZEN_DOC);
+    FrozenTree tree(root);
+    for(auto path : {"item", ".//title", "*[2]", ".//*[@id]", "group//title"}) {
+        auto expect = root.findall(path);
+        auto got = tree.getroot().findall(path);
+        REQUIRE(expect.size() == got.size());
+        for(size_t i = 0; i < got.size(); i++) {
+            REQUIRE(expect[i].text() == std::string(got[i].text()));
+        }
+    }
+}
+
+
+TEST_CASE("frozenParseError", "[frozen]")
+{
+    REQUIRE_THROWS_AS(FrozenTree::fromstring("<a><b></a>"), etree::xml_error);
+    REQUIRE_THROWS(FrozenTree::fromstring(""));
+}
+
+
+TEST_CASE("frozenMemoryUsage", "[frozen]")
+{
+    auto tree = FrozenTree::fromstring(FROZEN_DOC);
+    REQUIRE(tree.memory_usage() > 0);
+    REQUIRE(tree.memory_usage() < 1024);
+}
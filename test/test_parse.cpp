@@ -1,4 +1,5 @@
 
+#include <cstdio>
 #include <fcntl.h>
 #include <fstream>
 #include <iostream>
@@ -101,6 +102,68 @@ TEST_CASE("parseFdCorrupt", "[parse]")
 }
 
 
+//
+// etree::load_binary()
+//
+
+
+static etree::ElementTree
+binaryRoundTrip_(const etree::ElementTree &tree)
+{
+    FILE *fp = ::tmpfile();
+    REQUIRE(fp);
+    tree.save_binary(::fileno(fp));
+    ::lseek(::fileno(fp), 0, SEEK_SET);
+    auto out = etree::load_binary(::fileno(fp));
+    ::fclose(fp);
+    return out;
+}
+
+
+TEST_CASE("loadBinaryFixtures", "[parse]")
+{
+    for(auto path : {"testdata/metafilter.rss.xml", "testdata/pypy.atom.xml"}) {
+        auto tree = etree::parse(path);
+        auto loaded = binaryRoundTrip_(tree);
+        REQUIRE(etree::tostring(loaded) == etree::tostring(tree));
+    }
+}
+
+
+TEST_CASE("loadBinaryNodeTypes", "[parse]")
+{
+    auto tree = etree::fromstring(
+        "<!-- before --><a xmlns=\"urn:a\" xmlns:b=\"urn:b\" b:x=\"1\">"
+            "t<?pi data?><b:c xml:lang=\"en\"><![CDATA[<x>]]></b:c>"
+            "<!--c-->tail<d xmlns=\"urn:d\"><e/></d>"
+        "</a>"
+    ).getroottree();
+    auto loaded = binaryRoundTrip_(tree);
+    REQUIRE(etree::tostring(loaded) == etree::tostring(tree));
+    REQUIRE(loaded.getroot().find("{urn:b}c")->get(
+        "{http://www.w3.org/XML/1998/namespace}lang") == "en");
+    REQUIRE(loaded.getroot().find("{urn:d}d/{urn:d}e"));
+}
+
+
+TEST_CASE("loadBinaryCorrupt", "[parse]")
+{
+    REQUIRE_THROWS_AS(etree::load_binary("testdata/corrupt.xml"),
+                      etree::parse_error);
+    REQUIRE_THROWS_AS(etree::load_binary("testdata/missing"),
+                      etree::parse_error);
+
+    FILE *fp = ::tmpfile();
+    REQUIRE(fp);
+    etree::parse("testdata/pypy.atom.xml").save_binary(::fileno(fp));
+    off_t size = ::lseek(::fileno(fp), 0, SEEK_CUR);
+    REQUIRE(::ftruncate(::fileno(fp), size - 1) == 0);
+    ::lseek(::fileno(fp), 0, SEEK_SET);
+    REQUIRE_THROWS_AS(etree::load_binary(::fileno(fp)), etree::parse_error);
+    ::fclose(fp);
+}
+
+
 //
 // etree::html::fromstring()
 //
@@ -116,3 +116,106 @@ TEST_CASE("OpUnequalMissingNs", "[qname]")
     auto qn2 = etree::QName("{urn:ns2}nons");
     REQUIRE(qn != qn2);
 }
+
+
+TEST_CASE("AtomInterned", "[qname]")
+{
+    auto a = etree::Atom("{urn:ns}tag");
+    auto a2 = etree::Atom("urn:ns", "tag");
+    auto a3 = etree::Atom(etree::QName("{urn:ns}tag"));
+    REQUIRE(a == a2);
+    REQUIRE(a == a3);
+    REQUIRE(&a.qname() == &a2.qname());
+}
+
+
+TEST_CASE("AtomUnequal", "[qname]")
+{
+    auto a = etree::Atom("{urn:ns}tag");
+    auto a2 = etree::Atom("{urn:ns2}tag");
+    auto a3 = etree::Atom("tag");
+    REQUIRE(a != a2);
+    REQUIRE(a != a3);
+}
+
+
+TEST_CASE("AtomConvertsToQName", "[qname]")
+{
+    auto a = etree::Atom("{urn:ns}tag");
+    const etree::QName &qn = a;
+    REQUIRE(qn == etree::QName("urn:ns", "tag"));
+    REQUIRE(a.ns() == "urn:ns");
+    REQUIRE(a.tag() == "tag");
+}
+
+
+TEST_CASE("HashMatchesRaw", "[qname]")
+{
+    auto qn = etree::QName("{urn:ns}tag");
+    REQUIRE(qn.hash() == etree::QName::hash("urn:ns", "tag"));
+    REQUIRE(std::hash<etree::QName>()(qn) == qn.hash());
+    REQUIRE(etree::QName("tag").hash() == etree::QName::hash(NULL, "tag"));
+}
+
+
+TEST_CASE("HashSwappedParts", "[qname]")
+{
+    REQUIRE(etree::QName("a", "b").hash() != etree::QName("b", "a").hash());
+    REQUIRE(etree::QName("ab", "c").hash() != etree::QName("a", "bc").hash());
+}
+
+
+TEST_CASE("QNameSetContains", "[qname]")
+{
+    etree::QNameSet set {"{urn:ns}a", "b"};
+    REQUIRE(set.size() == 2);
+    REQUIRE(set.contains("{urn:ns}a"));
+    REQUIRE(set.contains("urn:ns", "a"));
+    REQUIRE(set.contains(NULL, "b"));
+    REQUIRE(set.contains("", "b"));
+    REQUIRE_FALSE(set.contains(NULL, "a"));
+    REQUIRE_FALSE(set.contains("urn:ns", "b"));
+    REQUIRE_FALSE(set.insert("b"));
+    REQUIRE(set.size() == 2);
+}
+
+
+TEST_CASE("QNameViewConstexpr", "[qname]")
+{
+    static constexpr etree::QNameView view("{urn:ns}tag");
+    static_assert(view.ns() == "urn:ns", "ns parsed at compile time");
+    static_assert(view.tag() == "tag", "tag parsed at compile time");
+    REQUIRE(etree::QName(view) == etree::QName("urn:ns", "tag"));
+    REQUIRE(view.tostring() == "{urn:ns}tag");
+}
+
+
+TEST_CASE("QNameViewNoNs", "[qname]")
+{
+    etree::QNameView view("tag");
+    REQUIRE(view.ns().empty());
+    REQUIRE(view.tag() == "tag");
+    REQUIRE(view.equals(NULL, "tag"));
+    REQUIRE_FALSE(view.equals("urn:ns", "tag"));
+}
+
+
+TEST_CASE("QNameViewInvalid", "[qname]")
+{
+    REQUIRE_THROWS_AS(etree::QNameView(std::string("{urn:ns")),
+                      etree::qname_error);
+    REQUIRE_THROWS_AS(etree::QNameView(std::string("{urn:ns}")),
+                      etree::qname_error);
+}
+
+
+TEST_CASE("ConstructStringView", "[qname]")
+{
+    std::string_view s("{urn:ns}tag-and-more");
+    auto qn = etree::QName(s.substr(0, 11));
+    REQUIRE(qn.ns() == "urn:ns");
+    REQUIRE(qn.tag() == "tag");
+    REQUIRE(qn == etree::QName("{urn:ns}tag"));
+    REQUIRE_THROWS_AS(etree::QName(std::string_view("{urn:ns}")),
+                      etree::qname_error);
+}
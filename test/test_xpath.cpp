@@ -128,3 +128,298 @@ TEST_CASE("FindTextDefault", "[xpath]")
     auto xp = etree::XPath("age");
     REQUIRE("Unknown" == xp.findtext(elem, "Unknown"));
 }
+
+
+TEST_CASE("CacheHit", "[xpath]")
+{
+    etree::XPathCache::clear();
+    etree::XPath("./cache-hit");
+    REQUIRE(etree::XPathCache::misses() == 1);
+    REQUIRE(etree::XPathCache::hits() == 0);
+
+    auto elem = etree::fromstring("<root><cache-hit/></root>");
+    auto xp = etree::XPath("./cache-hit");
+    REQUIRE(etree::XPathCache::misses() == 1);
+    REQUIRE(etree::XPathCache::hits() == 1);
+    REQUIRE(xp.findall(elem).size() == 1);
+}
+
+
+TEST_CASE("CacheKeyedByNamespaces", "[xpath]")
+{
+    etree::XPathContext ctx1(etree::ns_list{{"foo", "urn:foo"}});
+    etree::XPathContext ctx2(etree::ns_list{{"foo", "urn:bar"}});
+    auto elem = etree::fromstring(
+        "<root><child xmlns=\"urn:foo\"/></root>"
+    );
+
+    etree::XPathCache::clear();
+    auto xp1 = etree::XPath("foo:child", ctx1);
+    auto xp2 = etree::XPath("foo:child", ctx2);
+    auto xp3 = etree::XPath("foo:child", etree::XPathContext(ctx1));
+    REQUIRE(etree::XPathCache::misses() == 2);
+    REQUIRE(etree::XPathCache::hits() == 1);
+    REQUIRE(xp1.findall(elem).size() == 1);
+    REQUIRE(xp2.findall(elem).size() == 0);
+}
+
+
+TEST_CASE("CacheCapacity", "[xpath]")
+{
+    size_t old = etree::XPathCache::capacity();
+    etree::XPathCache::clear();
+    etree::XPathCache::capacity(2);
+    etree::XPath("a");
+    etree::XPath("b");
+    etree::XPath("a");
+    etree::XPath("c");
+    REQUIRE(etree::XPathCache::size() == 2);
+
+    etree::XPath("a");
+    REQUIRE(etree::XPathCache::hits() == 2);
+    etree::XPath("b");
+    REQUIRE(etree::XPathCache::misses() == 4);
+
+    etree::XPathCache::capacity(0);
+    REQUIRE(etree::XPathCache::size() == 0);
+    etree::XPathCache::capacity(old);
+}
+
+
+TEST_CASE("AssignSharesContext", "[xpath]")
+{
+    etree::XPathContext ctx(etree::ns_list{{"foo", "urn:foo"}});
+    auto elem = etree::fromstring(
+        "<root><child xmlns=\"urn:foo\"/></root>"
+    );
+    auto xp = etree::XPath(".");
+    xp = etree::XPath("foo:child", ctx);
+    REQUIRE(xp.findall(elem).size() == 1);
+}
+
+
+TEST_CASE("XPathSetFind", "[xpath]")
+{
+    etree::XPathContext ctx(etree::ns_list{{"foo", "urn:foo"}});
+    auto elem = etree::fromstring(
+        "<root xmlns:foo=\"urn:foo\">"
+            "<a>1</a><foo:b>2</foo:b><b>3</b><c><d>4</d></c><a>5</a>"
+        "</root>"
+    );
+
+    etree::XPathSet set;
+    REQUIRE(set.add(etree::XPath("a")) == 0);
+    REQUIRE(set.add(etree::XPath("foo:b", ctx)) == 1);
+    REQUIRE(set.add(etree::XPath("./b")) == 2);
+    REQUIRE(set.add(etree::XPath("c/d")) == 3);
+    REQUIRE(set.add(etree::XPath("missing")) == 4);
+    REQUIRE(set.size() == 5);
+
+    auto found = set.find(elem);
+    REQUIRE(found.size() == 5);
+    REQUIRE(found[0] == etree::XPath("a").find(elem));
+    REQUIRE(found[1]->text() == "2");
+    REQUIRE(found[2]->text() == "3");
+    REQUIRE(found[3]->text() == "4");
+    REQUIRE_FALSE(found[4]);
+}
+
+
+TEST_CASE("XPathSetFindall", "[xpath]")
+{
+    auto elem = etree::fromstring(
+        "<root><a>1</a><b/><a>2</a><c><a>3</a></c></root>"
+    );
+
+    etree::XPathSet set{"a", ".//a", "b"};
+    auto found = set.findall(elem);
+    REQUIRE(found.size() == 3);
+    REQUIRE(found[0] == etree::XPath("a").findall(elem));
+    REQUIRE(found[1].size() == 3);
+    REQUIRE(found[2].size() == 1);
+}
+
+
+TEST_CASE("XPathSetFindtext", "[xpath]")
+{
+    auto elem = etree::fromstring(
+        "<root><title>Hi</title><guid>123</guid></root>"
+    );
+
+    etree::XPathSet set{"title", "guid", "link"};
+    auto texts = set.findtext(elem, "none");
+    REQUIRE(texts.size() == 3);
+    REQUIRE(texts[0] == "Hi");
+    REQUIRE(texts[1] == "123");
+    REQUIRE(texts[2] == "none");
+}
+
+
+TEST_CASE("Iterfind", "[xpath]")
+{
+    auto elem = etree::fromstring("<root><a/>text<b/><c/></root>");
+    auto xp = etree::XPath("./node()");
+    auto res = xp.iterfind(elem);
+    REQUIRE(res.size() == 3);
+    REQUIRE_FALSE(res.empty());
+
+    std::vector<etree::Element> out;
+    for(auto e : res) {
+        out.push_back(e);
+    }
+    REQUIRE(out == elem.children());
+}
+
+
+TEST_CASE("IterfindNoMatch", "[xpath]")
+{
+    auto elem = etree::fromstring("<root><a/><b/><c/></root>");
+    auto res = elem.iterfind(etree::XPath("./nonexistent"));
+    REQUIRE(res.size() == 0);
+    REQUIRE(res.empty());
+    REQUIRE(res.begin() == res.end());
+}
+
+
+TEST_CASE("IterfindOutlivesElement", "[xpath]")
+{
+    auto res = etree::fromstring("<root><a/><b/></root>")
+        .iterfind(etree::XPath("*"));
+    auto copy = res;
+    REQUIRE(copy.size() == 2);
+    REQUIRE((*copy.begin()).tag() == "a");
+    REQUIRE((*++copy.begin()).tag() == "b");
+}
+
+
+TEST_CASE("ContextVariable", "[xpath]")
+{
+    auto elem = etree::fromstring(
+        "<root><item><guid>1</guid></item><item><guid>2</guid></item></root>"
+    );
+    etree::XPathContext ctx;
+    etree::XPath xp("item[guid=$guid]/guid", ctx);
+
+    ctx.variable("guid", "2");
+    REQUIRE(xp.findtext(elem) == "2");
+    ctx.variable("guid", 1.0);
+    REQUIRE(xp.findtext(elem) == "1");
+
+    etree::XPathContext copy(ctx);
+    etree::XPath xp2("item[guid=$guid]/guid", copy);
+    ctx.variable("guid", "2");
+    REQUIRE(xp2.findtext(elem) == "1");
+}
+
+
+TEST_CASE("BindVariable", "[xpath]")
+{
+    auto elem = etree::fromstring(
+        "<root><item><guid>1</guid></item><item><guid>2</guid></item></root>"
+    );
+    etree::XPath xp("item[guid=$guid]/guid");
+    REQUIRE_THROWS_AS(xp.find(elem), etree::xml_error);
+    REQUIRE(xp.bind({{"guid", "1"}}).findtext(elem) == "1");
+    REQUIRE(xp.bind({{"guid", "2"}}).findall(elem).size() == 1);
+    REQUIRE(xp.bind({{"guid", "3"}}).findall(elem).size() == 0);
+}
+
+
+TEST_CASE("BindVariableShadowsContext", "[xpath]")
+{
+    auto elem = etree::fromstring(
+        "<root><item><guid>1</guid></item><item><guid>2</guid></item></root>"
+    );
+    etree::XPathContext ctx;
+    ctx.variable("guid", "1");
+    etree::XPath xp("item[guid=$guid]/guid", ctx);
+
+    REQUIRE(xp.bind({{"guid", "2"}}).findtext(elem) == "2");
+    REQUIRE(xp.findtext(elem) == "1");
+}
+
+
+TEST_CASE("ExtensionFunction", "[xpath]")
+{
+    auto elem = etree::fromstring(
+        "<root><item><t>NEWS</t></item><item><t>Other</t></item></root>"
+    );
+    etree::XPathContext ctx(etree::ns_list{{"x", "urn:x"}});
+    ctx.function("{urn:x}lower", [](const std::vector<std::string> &args) {
+        std::string s(args.at(0));
+        for(auto &c : s) {
+            c = ::tolower(c);
+        }
+        return s;
+    });
+    ctx.function("count-args", [](const std::vector<std::string> &args) {
+        return int(args.size());
+    });
+    ctx.function("{urn:x}is-news", [](const std::vector<std::string> &args) {
+        return args.at(0) == "NEWS";
+    });
+
+    auto xp = etree::XPath("item[x:lower(t)='news']/t", ctx);
+    REQUIRE(xp.findtext(elem) == "NEWS");
+    REQUIRE(etree::XPath("item[x:is-news(t)]/t", ctx).findall(elem).size() == 1);
+    REQUIRE(etree::XPath("item[count-args(1, 2)]", ctx).findall(elem).size() == 1);
+
+    etree::XPathContext copy(ctx);
+    REQUIRE(etree::XPath("item[x:lower(t)='other']", copy).find(elem));
+}
+
+
+TEST_CASE("ExtensionFunctionThrows", "[xpath]")
+{
+    auto elem = etree::fromstring("<root/>");
+    etree::XPathContext ctx;
+    ctx.function("fail", [](const std::vector<std::string> &args)
+        -> etree::XPathValue {
+        throw std::out_of_range("fail");
+    });
+    etree::XPathContext other;
+    REQUIRE_THROWS_AS(etree::XPath("fail()", other).find(elem),
+                      etree::xml_error);
+    REQUIRE_THROWS_AS(etree::XPath("fail()", ctx).find(elem),
+                      std::out_of_range);
+    REQUIRE_FALSE(etree::XPath("*", ctx).find(elem));
+}
+
+
+TEST_CASE("PrepareForQueries", "[xpath]")
+{
+    auto root = etree::fromstring("<root><a/><b><c/></b><d/></root>");
+    root.getroottree().prepare_for_queries();
+
+    auto xp = etree::XPath("d | .//c | a");
+    auto found = xp.findall(root);
+    REQUIRE(found.size() == 3);
+    REQUIRE(found[0].tag() == "a");
+    REQUIRE(found[1].tag() == "c");
+    REQUIRE(found[2].tag() == "d");
+
+    auto a = *root.child("a");
+    root.append(a);
+    found = xp.findall(root);
+    REQUIRE(found[0].tag() == "c");
+    REQUIRE(found[1].tag() == "d");
+    REQUIRE(found[2].tag() == "a");
+}
+
+
+TEST_CASE("LazyXPath", "[xpath]")
+{
+    static constexpr etree::ns_literal kNs[] = {
+        {"x", "urn:x"}
+    };
+    static const etree::LazyXPath kPath("x:b", kNs);
+    static const etree::LazyXPath kPlainPath("c");
+
+    auto root = etree::fromstring(
+        "<a xmlns:x=\"urn:x\"><x:b>1</x:b><x:b>2</x:b><c>3</c></a>");
+    REQUIRE(kPath.get().expr() == "x:b");
+    REQUIRE(kPath.findall(root).size() == 2);
+    REQUIRE(kPath.findtext(root) == "1");
+    REQUIRE(kPlainPath.find(root)->text() == "3");
+    REQUIRE(&kPath.get() == &kPath.get());
+}